@@ -0,0 +1,138 @@
+package v8
+
+/*
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"errors"
+)
+
+var (
+	errNoSendAsyncHandler = errors.New("v8: Worker.HandleSendAsync is nil")
+	errWorkerDisposed     = errors.New("v8: Worker was disposed before the call completed")
+)
+
+// Result is the outcome of a SendAsync call. If the $recvSync callback threw,
+// or the Promise it returned was rejected, Err describes the reason.
+type Result struct {
+	Response string
+	Err      error
+}
+
+// SendAsync sends a message, calling the $recvSync callback in JavaScript, and
+// returns a channel on which the callback's result is delivered. If the
+// callback returns a Promise, as async functions do, the result is delivered
+// once it settles, and the Worker is free to handle other calls, including
+// other SendAsync calls, in the meantime. The result of a call whose Promise
+// is still pending when the Worker is Reset is never delivered.
+func (w *Worker) SendAsync(msg string) <-chan Result {
+	var result <-chan Result
+	w.runLocked(func() {
+		var call C.int
+		call, result = w.instance.startAsyncCall()
+		C.worker_send_async(w.instance.worker, call, stringData(msg), C.int(len(msg)))
+	})
+	return result
+}
+
+// SendAsync is like Worker.SendAsync, but calls the Context's $recvSync
+// callback.
+func (c *Context) SendAsync(msg string) <-chan Result {
+	var result <-chan Result
+	c.worker.runLocked(func() {
+		if c.ctx == nil {
+			closed := make(chan Result, 1)
+			closed <- Result{Err: errContextClosed}
+			result = closed
+			return
+		}
+		var call C.int
+		call, result = c.worker.instance.startAsyncCall()
+		C.worker_send_async_ctx(c.ctx, call, stringData(msg), C.int(len(msg)))
+	})
+	return result
+}
+
+// Register a new SendAsync call and return its id along with the channel for
+// its result.
+func (i *instance) startAsyncCall() (C.int, <-chan Result) {
+	result := make(chan Result, 1)
+	mutex.Lock()
+	i.lastAsyncCall++
+	if i.lastAsyncCall <= 0 {
+		i.lastAsyncCall = 1
+	}
+	call := i.lastAsyncCall
+	i.asyncCalls[call] = result
+	mutex.Unlock()
+	return C.int(call), result
+}
+
+// Fail any SendAsync calls that are still waiting on a Promise.
+func (i *instance) failAsyncCalls() {
+	mutex.Lock()
+	calls := i.asyncCalls
+	i.asyncCalls = nil
+	mutex.Unlock()
+	for _, result := range calls {
+		result <- Result{Err: errWorkerDisposed}
+	}
+}
+
+//export asyncResultCb
+func asyncResultCb(id int32, call C.int, rejected C.int, data *C.char, length C.int) {
+	mutex.Lock()
+	i := registry[id]
+	var result chan Result
+	if i != nil {
+		result = i.asyncCalls[int32(call)]
+		delete(i.asyncCalls, int32(call))
+	}
+	mutex.Unlock()
+	if result == nil {
+		return
+	}
+	msg := C.GoStringN(data, length)
+	if rejected != 0 {
+		result <- Result{Err: errors.New(msg)}
+	} else {
+		result <- Result{Response: msg}
+	}
+}
+
+//export recvAsyncCb
+func recvAsyncCb(id int32, request C.int, msg *C.char, length C.int) {
+	i := getInstance(id)
+	go i.settle(request, i.handleSendAsync, C.GoStringN(msg, length))
+}
+
+// Run the handler for a $sendAsync request and settle its Promise with the
+// result. Requests are settled independently of each other, so any number of
+// them can be in flight at once.
+func (i *instance) settle(request C.int, handler func(string) (string, error), msg string) {
+	var (
+		resp string
+		err  = errNoSendAsyncHandler
+	)
+	if handler != nil {
+		resp, err = handler(msg)
+	}
+	i.settleMutex.RLock()
+	defer i.settleMutex.RUnlock()
+	if i.disposed {
+		return
+	}
+	if err != nil {
+		resp = err.Error()
+	}
+	data := stringData(resp)
+	i.run(func() {
+		if err != nil {
+			C.worker_reject(i.worker, request, data, C.int(len(resp)))
+		} else {
+			C.worker_resolve(i.worker, request, data, C.int(len(resp)))
+		}
+	})
+}
@@ -1,22 +1,75 @@
 #include "binding.h"
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "libplatform/libplatform.h"
 #include "v8.h"
 
 using namespace v8;
 
+class SendQueue;
+class WorkerAllocator;
+
+// A Promise returned by $sendAsync that's waiting to be settled from Go, along
+// with the id of the context it was created in.
+struct PendingRequest {
+  int ctx;
+  Global<Promise::Resolver> resolver;
+};
+
 struct worker_s {
   int id;
+  bool batch_module_fetch;
+  bool resolve_module_urls;
+  bool snapshotting;
   Isolate* isolate;
+  StartupData snapshot;
   std::string last_exception;
   Persistent<Function> recv;
   Persistent<Context> context;
   Persistent<Function> recv_sync_handler;
+  Persistent<ObjectTemplate> global_template;
+  worker_module_stats module_stats;
+  std::unordered_map<int, worker_context*> tenants;
+  std::vector<Global<UnboundScript>> scripts;
+  SendQueue* send_queue;  // NULL unless $send messages are queued.
+  std::string send_buffer;
+  std::string sync_response;  // Borrowed by Go after worker_send_sync.
+  worker_channel* channel;  // NULL unless a channel has been opened.
+  int last_request_id;
+  std::unordered_map<int, PendingRequest> pending_requests;
+  Locker* owner;  // Held by the owner thread of an owned worker, or NULL.
+  WorkerAllocator* allocator;
+  size_t max_stack_bytes;
+  std::atomic<bool> heap_limit_reached;
+  size_t initial_heap_limit;  // Recorded when the heap limit is reached.
+};
+
+// A tenant context sharing its worker's isolate. Each tenant has its own
+// global scope, callbacks and ModuleData, and a distinct security token so
+// that it can't access the objects of other contexts.
+struct worker_context_s {
+  int id;
+  worker* w;
+  size_t allocated;  // Cumulative heap growth during calls into the tenant.
+  Persistent<Context> context;
+  Persistent<Function> recv;
+  Persistent<Function> recv_sync_handler;
 };
 
 // Per-context Module data, allowing sharing of module maps across top-level
@@ -40,11 +93,598 @@ class ModuleData {
 
   std::unordered_map<std::string, Global<Module>> url_to_module_map;
   std::unordered_map<Global<Module>, std::string, ModuleHash> module_to_url_map;
+
+  // Memoized results of resolving a specifier relative to a referrer url,
+  // keyed by the two joined with a NUL byte.
+  std::unordered_map<std::string, std::string> resolved_url_map;
+};
+
+// A process-wide LRU cache of V8 code caches, keyed by a digest of the script
+// source, and shared by all workers.
+class CodeCache {
+ public:
+  typedef std::shared_ptr<const std::string> Data;
+
+  explicit CodeCache(size_t capacity) : capacity_(capacity), size_(0) {}
+
+  Data Get(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+  }
+
+  void Put(const std::string& key, Data data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    RemoveLocked(key);
+    entries_.emplace_front(key, data);
+    index_[key] = entries_.begin();
+    size_ += data->size();
+    while (size_ > capacity_ && !entries_.empty()) {
+      RemoveLocked(entries_.back().first);
+    }
+  }
+
+  void Remove(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    RemoveLocked(key);
+  }
+
+  void SetCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    while (size_ > capacity_ && !entries_.empty()) {
+      RemoveLocked(entries_.back().first);
+    }
+  }
+
+  std::atomic<unsigned long long> memory_hits{0};
+  std::atomic<unsigned long long> disk_hits{0};
+  std::atomic<unsigned long long> misses{0};
+  std::atomic<unsigned long long> rejects{0};
+
+ private:
+  typedef std::list<std::pair<std::string, Data>> Entries;
+
+  void RemoveLocked(const std::string& key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return;
+    }
+    size_ -= it->second->second->size();
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  std::mutex mutex_;
+  size_t capacity_;
+  size_t size_;
+  Entries entries_;
+  std::unordered_map<std::string, Entries::iterator> index_;
+};
+
+CodeCache code_cache(64 << 20);
+
+// An immutable source buffer that may be shared by all workers.
+struct SharedSource {
+  std::string text;
+  bool ascii;
+};
+
+// A process-wide store of module sources keyed by their fully qualified url,
+// so that modules only need to be fetched from Go once.
+class ModuleSourceStore {
+ public:
+  typedef std::shared_ptr<const SharedSource> Source;
+
+  Source Get(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sources_.find(url);
+    if (it == sources_.end()) {
+      return nullptr;
+    }
+    return it->second;
+  }
+
+  // Adds the given source, unless another thread got there first, and returns
+  // the stored value.
+  Source Put(const std::string& url, std::string text) {
+    bool ascii = true;
+    for (char c : text) {
+      if (c & 0x80) {
+        ascii = false;
+        break;
+      }
+    }
+    Source source(new SharedSource{std::move(text), ascii});
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sources_.emplace(url, source).first->second;
+  }
+
+  void Invalidate(const std::string& url) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sources_.erase(url);
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sources_.clear();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, Source> sources_;
+};
+
+ModuleSourceStore module_sources;
+
+// Exposes an ASCII source to V8 without copying it. The source is kept
+// alive until V8 disposes of the string.
+class SharedSourceResource : public String::ExternalOneByteStringResource {
+ public:
+  explicit SharedSourceResource(ModuleSourceStore::Source source)
+      : source_(source) {}
+
+  const char* data() const override { return source_->text.data(); }
+  size_t length() const override { return source_->text.size(); }
+
+ private:
+  ModuleSourceStore::Source source_;
+};
+
+Local<String> NewSharedSourceString(Isolate* isolate,
+                                    ModuleSourceStore::Source source) {
+  if (source->ascii) {
+    Local<String> str;
+    if (String::NewExternalOneByte(isolate, new SharedSourceResource(source))
+            .ToLocal(&str)) {
+      return str;
+    }
+  }
+  return String::NewFromUtf8(isolate, source->text.data(),
+                             NewStringType::kNormal, source->text.size())
+      .ToLocalChecked();
+}
+
+// A process-wide pool of native buffers, bucketed by power-of-two capacity
+// from 2^kMinShift to 2^kMaxShift bytes, with up to kMaxFree idle buffers kept
+// in each bucket. Larger buffers aren't pooled.
+template <int kMinShift, int kMaxShift, size_t kMaxFree>
+class BufferPool {
+ public:
+  // Returns a buffer of at least the given length, and sets capacity to its
+  // actual size. If zeroed is set, the first length bytes are zeroed.
+  char* Acquire(size_t length, size_t* capacity, bool zeroed = false) {
+    int cls = SizeClass(length);
+    if (cls < 0) {
+      *capacity = length;
+      if (zeroed) {
+        return static_cast<char*>(calloc(1, length));
+      }
+      return static_cast<char*>(malloc(length));
+    }
+    *capacity = size_t(1) << (cls + kMinShift);
+    char* data = NULL;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_[cls].empty()) {
+        data = free_[cls].back();
+        free_[cls].pop_back();
+      }
+    }
+    if (data == NULL) {
+      data = static_cast<char*>(malloc(*capacity));
+    }
+    if (zeroed && data != NULL) {
+      memset(data, 0, length);
+    }
+    return data;
+  }
+
+  // Returns a buffer to the pool. The size may be either the length it was
+  // acquired with or its capacity, as both fall within the same bucket.
+  void Release(char* data, size_t size) {
+    if (data == NULL) {
+      return;
+    }
+    int cls = SizeClass(size);
+    if (cls >= 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_[cls].size() < kMaxFree) {
+        free_[cls].push_back(data);
+        return;
+      }
+    }
+    free(data);
+  }
+
+ private:
+  // Returns the index of the smallest bucket that fits the given length, or
+  // -1 if it's too large to be pooled.
+  static int SizeClass(size_t length) {
+    for (int shift = kMinShift; shift <= kMaxShift; shift++) {
+      if (length <= (size_t(1) << shift)) {
+        return shift - kMinShift;
+      }
+    }
+    return -1;
+  }
+
+  std::vector<char*> free_[kMaxShift - kMinShift + 1];
+  std::mutex mutex_;
+};
+
+// The buffers for the external strings that wrap large inbound messages. They
+// are returned to the pool when V8 finalizes their strings.
+BufferPool<10, 20, 16> string_buffers;
+
+// The backing stores of ArrayBuffers, shared by all workers. Typed arrays tend
+// to be allocated and collected at high rates, so small ones are recycled
+// rather than going back to malloc each time.
+BufferPool<4, 16, 256> array_buffers;
+
+// The ArrayBuffer allocator of a worker. Backing stores come from the shared
+// array_buffers pool, so that their ownership can be passed between Go and any
+// worker without copying, while the allocator keeps count of the bytes held by
+// its worker and enforces an optional limit on them. V8 itself reports the
+// backing stores of ArrayBuffers to the GC as external memory.
+class WorkerAllocator : public ArrayBuffer::Allocator {
+ public:
+  explicit WorkerAllocator(size_t limit) : allocated_(0), limit_(limit) {}
+
+  void* Allocate(size_t length) override {
+    if (!TryReserve(length)) {
+      return NULL;
+    }
+    size_t capacity;
+    return array_buffers.Acquire(length, &capacity, true);
+  }
+
+  void* AllocateUninitialized(size_t length) override {
+    if (!TryReserve(length)) {
+      return NULL;
+    }
+    size_t capacity;
+    return array_buffers.Acquire(length, &capacity);
+  }
+
+  // Keep the base class's other Free overloads, e.g. the AllocationMode one
+  // in V8 6.6, visible alongside this one.
+  using ArrayBuffer::Allocator::Free;
+
+  void Free(void* data, size_t length) override {
+    allocated_.fetch_sub(length);
+    array_buffers.Release(static_cast<char*>(data), length);
+  }
+
+  // Accounts for a backing store whose ownership has moved to the worker, or
+  // away from it, without being allocated or freed by it.
+  void Adopt(size_t length) { allocated_.fetch_add(length); }
+  void Disown(size_t length) { allocated_.fetch_sub(length); }
+
+  size_t allocated() const { return allocated_.load(); }
+
+ private:
+  // Not named Reserve, as V8 6.6's Allocator declares a virtual
+  // Reserve(size_t) returning void*, which this would clash with.
+  bool TryReserve(size_t length) {
+    size_t n = allocated_.fetch_add(length) + length;
+    if (limit_ != 0 && n > limit_) {
+      allocated_.fetch_sub(length);
+      return false;
+    }
+    return true;
+  }
+
+  std::atomic<size_t> allocated_;
+  size_t limit_;
+};
+
+// An external one-byte string backed by a buffer from string_buffers.
+class PooledStringResource : public String::ExternalOneByteStringResource {
+ public:
+  PooledStringResource(char* data, size_t length, size_t capacity)
+      : data_(data), length_(length), capacity_(capacity) {}
+
+  ~PooledStringResource() override { string_buffers.Release(data_, capacity_); }
+
+  const char* data() const override { return data_; }
+  size_t length() const override { return length_; }
+
+ private:
+  char* data_;
+  size_t length_;
+  size_t capacity_;
+};
+
+// Messages shorter than this are cheaper to copy onto the V8 heap than to wrap
+// in an external string.
+const int kMinExternalMessageLength = 1024;
+
+// Returns the number of Latin-1 characters encoded by the given UTF-8 data, or
+// -1 if it contains characters outside of Latin-1.
+int Latin1Length(const char* data, int length) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  int n = 0;
+  for (int i = 0; i < length; n++) {
+    if (p[i] < 0x80) {
+      i++;
+    } else if ((p[i] == 0xc2 || p[i] == 0xc3) && i + 1 < length &&
+               (p[i + 1] & 0xc0) == 0x80) {
+      i += 2;
+    } else {
+      return -1;
+    }
+  }
+  return n;
+}
+
+// Creates a string from a UTF-8 message that's only borrowed for the duration
+// of the call. Large messages that fit within Latin-1 are copied, and
+// transcoded if need be, into a pooled buffer that's wrapped in an external
+// string, instead of being transcoded onto the V8 heap.
+MaybeLocal<String> NewMessageString(Isolate* isolate,
+                                    const char* data,
+                                    int length) {
+  int n;
+  if (length < kMinExternalMessageLength ||
+      (n = Latin1Length(data, length)) < 0 ||
+      size_t(n) > size_t(String::kMaxLength)) {
+    return String::NewFromUtf8(isolate, data, NewStringType::kNormal, length);
+  }
+  size_t capacity;
+  char* buf = string_buffers.Acquire(n, &capacity);
+  if (n == length) {
+    memcpy(buf, data, length);
+  } else {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    for (int i = 0, j = 0; i < length; j++) {
+      if (p[i] < 0x80) {
+        buf[j] = p[i++];
+      } else {
+        buf[j] = ((p[i] & 0x03) << 6) | (p[i + 1] & 0x3f);
+        i += 2;
+      }
+    }
+  }
+  return String::NewExternalOneByte(isolate,
+                                    new PooledStringResource(buf, n, capacity));
+}
+
+// Hands chunks of a script, as they're written from Go, to V8's streaming
+// parser, which pulls them from a background thread.
+class ChunkedSourceStream : public ScriptCompiler::ExternalSourceStream {
+ public:
+  ChunkedSourceStream() : done_(false) {}
+
+  ~ChunkedSourceStream() override {
+    for (auto& chunk : chunks_) {
+      delete[] chunk.first;
+    }
+  }
+
+  // Blocks until a chunk is available. V8 takes ownership of the returned
+  // buffer, and a return value of 0 signals the end of the script.
+  size_t GetMoreData(const uint8_t** src) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !chunks_.empty() || done_; });
+    if (chunks_.empty()) {
+      *src = NULL;
+      return 0;
+    }
+    std::pair<const uint8_t*, size_t> chunk = chunks_.front();
+    chunks_.pop_front();
+    *src = chunk.first;
+    return chunk.second;
+  }
+
+  void Push(const char* data, size_t length) {
+    uint8_t* chunk = new uint8_t[length];
+    memcpy(chunk, data, length);
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunks_.emplace_back(chunk, length);
+    cond_.notify_one();
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    cond_.notify_one();
+  }
+
+ private:
+  std::condition_variable cond_;
+  std::deque<std::pair<const uint8_t*, size_t>> chunks_;
+  bool done_;
+  std::mutex mutex_;
+};
+
+Platform* default_platform = NULL;
+
+// Blocks until it has been counted down a given number of times.
+class Latch {
+ public:
+  explicit Latch(int count) : count_(count) {}
+
+  void CountDown() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--count_ == 0) {
+      cond_.notify_all();
+    }
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return count_ == 0; });
+  }
+
+ private:
+  std::condition_variable cond_;
+  int count_;
+  std::mutex mutex_;
+};
+
+// Runs a streaming compile on one of the platform's worker threads.
+class BackgroundCompileTask : public Task {
+ public:
+  BackgroundCompileTask(ScriptCompiler::ScriptStreamingTask* task, Latch* latch)
+      : task_(task), latch_(latch) {}
+
+  void Run() override {
+    task_->Run();
+    latch_->CountDown();
+  }
+
+ private:
+  ScriptCompiler::ScriptStreamingTask* task_;
+  Latch* latch_;
+};
+
+// Queues the messages sent with $send so that they can be handed to Go in
+// batches rather than one cgo call at a time.
+class SendQueue {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  SendQueue(int id,
+            size_t flush_size,
+            size_t flush_bytes,
+            Clock::duration flush_interval)
+      : id_(id),
+        flush_size_(flush_size),
+        flush_bytes_(flush_bytes),
+        flush_interval_(flush_interval),
+        bytes_(0) {}
+
+  // Adds a message and returns whether the queue has reached one of its
+  // thresholds and should be flushed.
+  bool Push(int ctx, std::string&& msg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clock::time_point now = Clock::now();
+    if (messages_.empty()) {
+      oldest_ = now;
+    }
+    bytes_ += msg.size();
+    messages_.emplace_back(ctx, std::move(msg));
+    return messages_.size() >= flush_size_ || bytes_ >= flush_bytes_ ||
+           now - oldest_ >= flush_interval_;
+  }
+
+  // Hands all of the queued messages to Go. Flushes are serialized so that
+  // batches are delivered in the order they were queued.
+  void Flush();
+
+ private:
+  int id_;
+  size_t flush_size_;
+  size_t flush_bytes_;
+  Clock::duration flush_interval_;
+  size_t bytes_;
+  std::mutex flush_mutex_;
+  std::vector<std::pair<int, std::string>> messages_;
+  std::mutex mutex_;
+  Clock::time_point oldest_;
+};
+
+// The header of a single-producer, single-consumer ring buffer shared between
+// Go and JavaScript. The producer and consumer fields are kept on separate
+// cache lines. Positions are byte offsets that wrap around at 2^32, and each
+// message is framed as a 32-bit length followed by its data, padded to a
+// multiple of 4 bytes. The layout is mirrored by channel.go.
+struct RingHeader {
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> producer_waiting;
+  char producer_padding[56];
+  std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> consumer_waiting;
+  char consumer_padding[56];
+};
+
+static_assert(sizeof(RingHeader) == 128, "unexpected RingHeader layout");
+
+// Returns the size of the frame holding a message of the given length.
+inline uint32_t RingFrameSize(uint32_t length) {
+  return 4 + ((length + 3) & ~3u);
+}
+
+// Copies data into or out of a ring's data region starting at the given
+// position, wrapping around its end as needed.
+void RingCopyIn(char* data, uint32_t capacity, uint32_t pos, const char* src,
+                uint32_t length) {
+  uint32_t offset = pos & (capacity - 1);
+  uint32_t first = std::min(length, capacity - offset);
+  memcpy(data + offset, src, first);
+  memcpy(data, src + first, length - first);
+}
+
+void RingCopyOut(const char* data, uint32_t capacity, uint32_t pos, char* dst,
+                 uint32_t length) {
+  uint32_t offset = pos & (capacity - 1);
+  uint32_t first = std::min(length, capacity - offset);
+  memcpy(dst, data + offset, first);
+  memcpy(dst + first, data, length - first);
+}
+
+// A pair of ring buffers through which Go and JavaScript exchange messages
+// without either side entering the other's runtime while the rings are busy.
+// The inbound ring carries messages from Go to JavaScript and the outbound ring
+// carries them back. JavaScript blocks on cond when it has to wait for Go.
+struct worker_channel_s {
+  worker* w;
+  uint32_t capacity;
+  char* inbound;
+  char* outbound;
+  std::atomic<bool> closed;
+  std::condition_variable cond;
+  std::mutex mutex;
+};
+
+// Blocks until the given predicate holds, the channel is closed, or the timeout
+// elapses, after flagging that the JavaScript side is waiting. A negative
+// timeout waits indefinitely.
+template <typename Predicate>
+void ChannelWait(worker_channel* c,
+                 std::atomic<uint32_t>& waiting,
+                 double timeout_ms,
+                 Predicate ready) {
+  waiting.store(1);
+  if (!ready() && !c->closed.load()) {
+    std::unique_lock<std::mutex> lock(c->mutex);
+    auto done = [&] { return ready() || c->closed.load(); };
+    if (timeout_ms < 0) {
+      c->cond.wait(lock, done);
+    } else {
+      c->cond.wait_for(
+          lock, std::chrono::duration<double, std::milli>(timeout_ms), done);
+    }
+  }
+  waiting.store(0);
+}
+
+// A script that is being streamed into a worker.
+struct worker_script_stream_s {
+  // Held from start to finish, so the isolate can't be used, reset or disposed
+  // while the parser thread is running. Declared first so it's released last.
+  std::unique_ptr<Locker> locker;
+  worker* w;
+  std::string name;
+  // A copy of the source written so far, as Compile needs the full source
+  // once parsing is done. V8 keeps its own copy of the chunks until then, so
+  // the stream's peak memory is about twice the size of the source.
+  std::string text;
+  bool ascii;
+  ChunkedSourceStream* stream;  // Owned by source.
+  std::unique_ptr<ScriptCompiler::StreamedSource> source;
+  std::unique_ptr<ScriptCompiler::ScriptStreamingTask> task;
+  std::thread parser;
 };
 
 // CopyString converts a std::string to a C string.
 const char* CopyString(const std::string& value) {
-  char* c = (char*)malloc(value.length());
+  char* c = (char*)malloc(value.length() + 1);
   strcpy(c, value.c_str());
   return c;
 }
@@ -130,35 +770,159 @@ void InitModuleData(Local<Context> context) {
       1, new ModuleData(context->GetIsolate()));
 }
 
+void DisposeModuleData(Local<Context> context) {
+  delete GetModuleData(context);
+  context->SetAlignedPointerInEmbedderData(1, NULL);
+}
+
+// Returns the tenant that owns the given context, or NULL if it's the worker's
+// default context.
+worker_context* GetTenant(Local<Context> context) {
+  return static_cast<worker_context*>(
+      context->GetAlignedPointerFromEmbedderData(2));
+}
+
+size_t UsedHeapSize(Isolate* isolate) {
+  HeapStatistics stats;
+  isolate->GetHeapStatistics(&stats);
+  return stats.used_heap_size();
+}
+
+// Attributes any heap growth while it's in scope to the given tenant. V8 has no
+// per-context accounting, so this is only an approximation of what a tenant
+// allocates on the shared heap: memory that is later freed is never
+// subtracted, and a GC during the call hides whatever it reclaims.
+class AllocationScope {
+ public:
+  explicit AllocationScope(worker_context* c)
+      : c_(c), start_(UsedHeapSize(c->w->isolate)) {}
+
+  ~AllocationScope() {
+    size_t end = UsedHeapSize(c_->w->isolate);
+    if (end > start_) {
+      c_->allocated += end - start_;
+    }
+  }
+
+ private:
+  worker_context* c_;
+  size_t start_;
+};
+
+extern "C" {
+#include "_cgo_export.h"
+
+void SendQueue::Flush() {
+  std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+  std::vector<std::pair<int, std::string>> batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch.swap(messages_);
+    bytes_ = 0;
+  }
+  if (batch.empty()) {
+    return;
+  }
+  std::vector<int> ctxs;
+  std::vector<const char*> msgs;
+  std::vector<int> lengths;
+  ctxs.reserve(batch.size());
+  msgs.reserve(batch.size());
+  lengths.reserve(batch.size());
+  for (auto& it : batch) {
+    ctxs.push_back(it.first);
+    msgs.push_back(it.second.data());
+    lengths.push_back(it.second.size());
+  }
+  flushSendQueue(id_, batch.size(), ctxs.data(), (char**)msgs.data(),
+                 lengths.data());
+}
+
+// Flushes any queued $send messages once control returns from JavaScript.
+void FlushSendQueue(Isolate* isolate) {
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  if (w->send_queue != NULL) {
+    w->send_queue->Flush();
+  }
+}
+
+// Resolves a module specifier relative to the url of the module importing it,
+// calling into Go only once for each pair. If the worker doesn't resolve module
+// urls, specifiers are used as is. Returns false, with an exception thrown, on
+// error.
+bool ResolveModuleURL(worker* w,
+                      ModuleData* d,
+                      const std::string& specifier,
+                      const std::string& referrer,
+                      std::string* resolved) {
+  if (!w->resolve_module_urls) {
+    *resolved = specifier;
+    return true;
+  }
+  std::string key = referrer;
+  key.push_back('\0');
+  key.append(specifier);
+  auto it = d->resolved_url_map.find(key);
+  if (it != d->resolved_url_map.end()) {
+    *resolved = it->second;
+    return true;
+  }
+  char* err = NULL;
+  char* url = resolveModuleURL(w->id, (char*)specifier.c_str(),
+                               (char*)referrer.c_str(), &err);
+  if (url == NULL) {
+    w->isolate->ThrowException(
+        Exception::Error(String::NewFromUtf8(w->isolate, err)));
+    free(err);
+    return false;
+  }
+  *resolved = url;
+  free(url);
+  d->resolved_url_map.emplace(key, *resolved);
+  return true;
+}
+
 MaybeLocal<Module> ResolveModuleCallback(Local<Context> context,
-                                         Local<String> url,
+                                         Local<String> specifier,
                                          Local<Module> referrer) {
   Isolate* isolate = context->GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
   ModuleData* d = GetModuleData(context);
-  std::string url_str = ToStdString(isolate, url);
-  auto module_it = d->url_to_module_map.find(url_str);
+  auto referrer_it =
+      d->module_to_url_map.find(Global<Module>(isolate, referrer));
+  assert(referrer_it != d->module_to_url_map.end());
+  std::string url;
+  if (!ResolveModuleURL(w, d, ToStdString(isolate, specifier),
+                        referrer_it->second, &url)) {
+    return MaybeLocal<Module>();
+  }
+  auto module_it = d->url_to_module_map.find(url);
+  if (module_it == d->url_to_module_map.end()) {
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(
+        isolate, ("v8worker: module not loaded: " + url).c_str())));
+    return MaybeLocal<Module>();
+  }
   return module_it->second.Get(isolate);
 }
 
-extern "C" {
-#include "_cgo_export.h"
-
-void LoadModule(worker* w,
-                Local<Context> context,
-                Local<String> url,
-                MaybeLocal<Module>& mod) {
+// Compiles the module with the given url and source, and adds it to the
+// context's module map.
+MaybeLocal<Module> CompileAndRegisterModule(worker* w,
+                                            Local<Context> context,
+                                            const std::string& url_str,
+                                            ModuleSourceStore::Source stored) {
+  EscapableHandleScope handle_scope(w->isolate);
+  Local<String> url = String::NewFromUtf8(w->isolate, url_str.c_str());
   ScriptOrigin origin(url, Local<Integer>(), Local<Integer>(), Local<Boolean>(),
                       Local<Integer>(), Local<Value>(), Local<Boolean>(),
                       Local<Boolean>(), True(w->isolate));
 
-  std::string url_str = ToStdString(w->isolate, url);
-  char* source_str = getModuleSource(w->id, (char*)url_str.c_str());
-  Local<String> source_text = String::NewFromUtf8(w->isolate, source_str);
+  Local<String> source_text = NewSharedSourceString(w->isolate, stored);
   ScriptCompiler::Source source(source_text, origin);
 
   Local<Module> module;
   if (!ScriptCompiler::CompileModule(w->isolate, &source).ToLocal(&module)) {
-    return;
+    return MaybeLocal<Module>();
   }
 
   ModuleData* d = GetModuleData(context);
@@ -166,18 +930,199 @@ void LoadModule(worker* w,
       std::make_pair(url_str, Global<Module>(w->isolate, module)));
   d->module_to_url_map.insert(
       std::make_pair(Global<Module>(w->isolate, module), url_str));
+  return handle_scope.Escape(module);
+}
 
-  for (int i = 0, length = module->GetModuleRequestsLength(); i < length; ++i) {
-    Local<String> name = module->GetModuleRequest(i);
-    MaybeLocal<Module> submodule;
-    LoadModule(w, context, name, submodule);
-    if (submodule.IsEmpty()) {
-      return;
+// Fetches the sources for the given urls, either individually or with a single
+// batched call into Go. Returns false, with an exception thrown, on error.
+bool FetchModuleSources(worker* w,
+                        const std::vector<const char*>& urls,
+                        std::vector<ModuleSourceStore::Source>& sources,
+                        bool batch) {
+  if (!batch) {
+    for (const char* url : urls) {
+      char* err = NULL;
+      char* source_str = getModuleSource(w->id, (char*)url, &err);
+      if (source_str == NULL) {
+        w->isolate->ThrowException(
+            Exception::Error(String::NewFromUtf8(w->isolate, err)));
+        free(err);
+        return false;
+      }
+      sources.push_back(module_sources.Put(url, source_str));
+      free(source_str);
+    }
+    return true;
+  }
+  std::vector<char*> fetched(urls.size(), NULL);
+  char* err = getModuleSources(w->id, (char**)urls.data(), urls.size(),
+                               fetched.data());
+  if (err != NULL) {
+    for (char* source_str : fetched) {
+      free(source_str);
+    }
+    w->isolate->ThrowException(
+        Exception::Error(String::NewFromUtf8(w->isolate, err)));
+    free(err);
+    return false;
+  }
+  for (size_t i = 0; i < urls.size(); i++) {
+    sources.push_back(module_sources.Put(urls[i], fetched[i]));
+    free(fetched[i]);
+  }
+  return true;
+}
+
+// Loads a module graph iteratively, a level at a time. Each url is only
+// fetched and compiled once per context, and modules that are already in the
+// context's module map are reused, so that shared dependencies and import
+// cycles are handled without repeated work. If batch is set, the sources of
+// all the modules in a level that aren't in the source store are fetched from
+// Go with a single call, so that Go can fetch them concurrently.
+void LoadModule(worker* w,
+                Local<Context> context,
+                Local<String> url,
+                bool batch,
+                MaybeLocal<Module>& mod) {
+  ModuleData* d = GetModuleData(context);
+  std::string root = ToStdString(w->isolate, url);
+  std::unordered_set<std::string> seen{root};
+  std::vector<std::string> level{root};
+  Local<Module> root_module;
+
+  while (!level.empty()) {
+    std::vector<ModuleSourceStore::Source> sources(level.size());
+    std::vector<const char*> missing;
+    std::vector<size_t> missing_index;
+    for (size_t i = 0; i < level.size(); i++) {
+      if (d->url_to_module_map.count(level[i])) {
+        continue;
+      }
+      sources[i] = module_sources.Get(level[i]);
+      if (!sources[i]) {
+        missing.push_back(level[i].c_str());
+        missing_index.push_back(i);
+      }
     }
+
+    if (!missing.empty()) {
+      std::vector<ModuleSourceStore::Source> fetched;
+      if (!FetchModuleSources(w, missing, fetched, batch)) {
+        return;
+      }
+      for (size_t j = 0; j < missing.size(); j++) {
+        sources[missing_index[j]] = fetched[j];
+      }
+      w->module_stats.fetched += missing.size();
+    }
+
+    std::vector<std::string> next;
+    for (size_t i = 0; i < level.size(); i++) {
+      Local<Module> module;
+      auto module_it = d->url_to_module_map.find(level[i]);
+      if (module_it != d->url_to_module_map.end()) {
+        module = module_it->second.Get(w->isolate);
+        w->module_stats.reused++;
+      } else if (!CompileAndRegisterModule(w, context, level[i], sources[i])
+                      .ToLocal(&module)) {
+        return;
+      } else {
+        w->module_stats.compiled++;
+      }
+      if (root_module.IsEmpty()) {
+        root_module = module;
+      }
+      for (int j = 0, length = module->GetModuleRequestsLength(); j < length;
+           ++j) {
+        std::string name;
+        if (!ResolveModuleURL(
+                w, d, ToStdString(w->isolate, module->GetModuleRequest(j)),
+                level[i], &name)) {
+          return;
+        }
+        if (seen.insert(name).second) {
+          next.push_back(name);
+        } else {
+          w->module_stats.reused++;
+        }
+      }
+    }
+    level.swap(next);
+  }
+
+  mod = root_module;
+}
+
+// A pending import() expression, which is loaded by a microtask.
+struct DynamicImport {
+  worker* w;
+  Global<Context> context;
+  Global<Promise::Resolver> resolver;
+  std::string specifier;
+  std::string referrer;
+};
+
+// Loads, instantiates and evaluates the module graph for an import()
+// expression, and settles its promise.
+void RunDynamicImport(void* data) {
+  std::unique_ptr<DynamicImport> import(static_cast<DynamicImport*>(data));
+  worker* w = import->w;
+  Isolate* isolate = w->isolate;
+  HandleScope handle_scope(isolate);
+  Local<Context> context = Local<Context>::New(isolate, import->context);
+  // The context may have been reset since the import() was evaluated.
+  if (GetModuleData(context) == NULL) {
+    return;
+  }
+  Context::Scope context_scope(context);
+  Local<Promise::Resolver> resolver =
+      Local<Promise::Resolver>::New(isolate, import->resolver);
+
+  TryCatch try_catch(isolate);
+  Local<Module> module;
+  std::string url;
+  MaybeLocal<Module> mod;
+  if (ResolveModuleURL(w, GetModuleData(context), import->specifier,
+                       import->referrer, &url)) {
+    LoadModule(w, context, String::NewFromUtf8(isolate, url.c_str()),
+               w->batch_module_fetch, mod);
+  }
+  if (mod.ToLocal(&module) &&
+      module->InstantiateModule(context, ResolveModuleCallback)
+          .FromMaybe(false) &&
+      !module->Evaluate(context).IsEmpty()) {
+    resolver->Resolve(context, module->GetModuleNamespace()).FromJust();
+  } else if (!try_catch.HasTerminated()) {
+    resolver->Reject(context, try_catch.Exception()).FromJust();
+  }
+}
+
+// The HostImportModuleDynamicallyCallback for import() expressions. The module
+// graph is loaded through the context's module map, so that modules which have
+// already been loaded or prefetched are reused. Loading is left to a
+// microtask, so that no module code runs in the middle of the statement
+// containing the import(), and the returned promise is always pending.
+MaybeLocal<Promise> ImportModuleDynamically(Local<Context> context,
+                                            Local<ScriptOrModule> referrer,
+                                            Local<String> specifier) {
+  Isolate* isolate = context->GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  EscapableHandleScope handle_scope(isolate);
+
+  Local<Promise::Resolver> resolver;
+  if (!Promise::Resolver::New(context).ToLocal(&resolver)) {
+    return MaybeLocal<Promise>();
   }
 
-  mod = module;
-  return;
+  String::Utf8Value referrer_url(isolate, referrer->GetResourceName());
+  DynamicImport* import = new DynamicImport;
+  import->w = w;
+  import->context.Reset(isolate, context);
+  import->resolver.Reset(isolate, resolver);
+  import->specifier = ToStdString(isolate, specifier);
+  import->referrer = ToCString(referrer_url);
+  isolate->EnqueueMicrotask(RunDynamicImport, import);
+  return handle_scope.Escape(resolver->GetPromise());
 }
 
 // The $print function.
@@ -206,14 +1151,18 @@ void Recv(const FunctionCallbackInfo<Value>& args) {
 
   HandleScope handle_scope(isolate);
 
-  Local<Context> context = Local<Context>::New(w->isolate, w->context);
-  Context::Scope context_scope(context);
+  Local<Context> context = isolate->GetCurrentContext();
+  worker_context* tenant = GetTenant(context);
 
   Local<Value> v = args[0];
   assert(v->IsFunction());
   Local<Function> func = Local<Function>::Cast(v);
 
-  w->recv.Reset(isolate, func);
+  if (tenant != NULL) {
+    tenant->recv.Reset(isolate, func);
+  } else {
+    w->recv.Reset(isolate, func);
+  }
 }
 
 // The $recvSync function. Sets the given callback.
@@ -224,86 +1173,627 @@ void RecvSync(const FunctionCallbackInfo<Value>& args) {
 
   HandleScope handle_scope(isolate);
 
-  Local<Context> context = Local<Context>::New(w->isolate, w->context);
-  Context::Scope context_scope(context);
+  Local<Context> context = isolate->GetCurrentContext();
+  worker_context* tenant = GetTenant(context);
 
   Local<Value> v = args[0];
   assert(v->IsFunction());
   Local<Function> func = Local<Function>::Cast(v);
 
-  w->recv_sync_handler.Reset(isolate, func);
+  if (tenant != NULL) {
+    tenant->recv_sync_handler.Reset(isolate, func);
+  } else {
+    w->recv_sync_handler.Reset(isolate, func);
+  }
 }
 
-// The $send function. Calls the corresponding worker's Callback in Go.
-void Send(const FunctionCallbackInfo<Value>& args) {
-  std::string msg;
-  worker* w = NULL;
-  {
-    Isolate* isolate = args.GetIsolate();
-    w = static_cast<worker*>(isolate->GetData(0));
-    assert(w->isolate == isolate);
+// Writes the UTF-8 encoding of a string into the given buffer, replacing its
+// contents.
+void WriteUtf8(Local<String> str, std::string* out) {
+  int length = str->Utf8Length();
+  out->resize(length);
+  if (length > 0) {
+    str->WriteUtf8(&(*out)[0], length, NULL, String::NO_NULL_TERMINATION);
+  }
+}
 
-    Locker locker(w->isolate);
-    HandleScope handle_scope(isolate);
+// The $send function. Calls the corresponding worker's Callback in Go. The
+// isolate is already locked and entered by whoever called into JavaScript, so
+// the message is simply written into the worker's send buffer, which Go only
+// borrows for the duration of the call.
+void Send(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  assert(w->isolate == isolate);
 
-    Local<Context> context = Local<Context>::New(w->isolate, w->context);
-    Context::Scope context_scope(context);
+  if (w->snapshotting) {
+    isolate->ThrowException(String::NewFromUtf8(
+        isolate, "v8worker: $send is not available in snapshots"));
+    return;
+  }
 
-    Local<Value> v = args[0];
-    assert(v->IsString());
+  assert(args[0]->IsString());
+  Local<String> str = Local<String>::Cast(args[0]);
+  worker_context* tenant = GetTenant(isolate->GetCurrentContext());
+  int ctx = tenant != NULL ? tenant->id : 0;
 
-    String::Utf8Value str(v);
-    msg = ToCString(str);
+  if (w->send_queue != NULL) {
+    std::string msg;
+    WriteUtf8(str, &msg);
+    if (w->send_queue->Push(ctx, std::move(msg))) {
+      w->send_queue->Flush();
+    }
+    return;
   }
-  // TODO(tav): should we use Unlocker?
-  recvCb(w->id, (char*)msg.c_str());
+
+  WriteUtf8(str, &w->send_buffer);
+  recvCb(w->id, ctx, (char*)w->send_buffer.data(), w->send_buffer.size());
 }
 
 // The $sendSync function. Calls the corresponding worker's SyncCallback in Go.
+// The response is borrowed from a buffer owned by Go and is only valid until
+// the next call.
 void SendSync(const FunctionCallbackInfo<Value>& args) {
-  std::string msg;
-  worker* w = NULL;
+  Isolate* isolate = args.GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  assert(w->isolate == isolate);
+
+  if (w->snapshotting) {
+    isolate->ThrowException(String::NewFromUtf8(
+        isolate, "v8worker: $sendSync is not available in snapshots"));
+    return;
+  }
+
+  assert(args[0]->IsString());
+  Local<String> str = Local<String>::Cast(args[0]);
+  worker_context* tenant = GetTenant(isolate->GetCurrentContext());
+  int ctx = tenant != NULL ? tenant->id : 0;
+
+  WriteUtf8(str, &w->send_buffer);
+  char* resp = NULL;
+  int length = recvSyncCb(w->id, ctx, (char*)w->send_buffer.data(),
+                          w->send_buffer.size(), &resp);
+  args.GetReturnValue().Set(
+      String::NewFromUtf8(isolate, resp, NewStringType::kNormal, length)
+          .ToLocalChecked());
+}
+
+// The $sendAsync function. Returns a Promise and passes the message to Go
+// along with a request id. Go settles the Promise later, from any thread, with
+// worker_resolve or worker_reject, and the worker is free to carry on in the
+// meantime.
+void SendAsync(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  assert(w->isolate == isolate);
+
+  if (w->snapshotting) {
+    isolate->ThrowException(String::NewFromUtf8(
+        isolate, "v8worker: $sendAsync is not available in snapshots"));
+    return;
+  }
+
+  assert(args[0]->IsString());
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Promise::Resolver> resolver;
+  if (!Promise::Resolver::New(context).ToLocal(&resolver)) {
+    return;
+  }
+  worker_context* tenant = GetTenant(context);
+
+  int id = ++w->last_request_id;
+  if (id <= 0) {
+    id = w->last_request_id = 1;
+  }
+  PendingRequest& req = w->pending_requests[id];
+  req.ctx = tenant != NULL ? tenant->id : 0;
+  req.resolver.Reset(isolate, resolver);
+
+  WriteUtf8(Local<String>::Cast(args[0]), &w->send_buffer);
+  recvAsyncCb(w->id, id, (char*)w->send_buffer.data(), w->send_buffer.size());
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+// The $sendBuffer function. Passes the contents of an ArrayBuffer, or of the
+// ArrayBuffer underlying a typed array or DataView, to the worker's
+// BufferCallback in Go. Ownership of the memory moves to Go and the buffer is
+// detached, so it reads as empty within JavaScript from then on. Buffers whose
+// memory V8 doesn't own, e.g. ones that have already been externalized, are
+// copied instead.
+void SendBuffer(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  assert(w->isolate == isolate);
+
+  HandleScope handle_scope(isolate);
+
+  if (w->snapshotting) {
+    isolate->ThrowException(String::NewFromUtf8(
+        isolate, "v8worker: $sendBuffer is not available in snapshots"));
+    return;
+  }
+
+  Local<ArrayBuffer> buffer;
+  size_t offset = 0;
+  size_t length = 0;
+  if (args[0]->IsArrayBuffer()) {
+    buffer = Local<ArrayBuffer>::Cast(args[0]);
+    length = buffer->ByteLength();
+  } else if (args[0]->IsArrayBufferView()) {
+    Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(args[0]);
+    buffer = view->Buffer();
+    offset = view->ByteOffset();
+    length = view->ByteLength();
+  } else {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(
+        isolate, "v8worker: $sendBuffer expects an ArrayBuffer or view")));
+    return;
+  }
+
+  void* data;
+  size_t size;
+  if (!buffer->IsExternal() && buffer->IsNeuterable()) {
+    ArrayBuffer::Contents contents = buffer->Externalize();
+    buffer->Neuter();
+    data = contents.Data();
+    size = contents.ByteLength();
+    w->allocator->Disown(size);
+  } else {
+    ArrayBuffer::Contents contents = buffer->GetContents();
+    data = worker_buffer_alloc(length);
+    memcpy(data, static_cast<char*>(contents.Data()) + offset, length);
+    size = length;
+    offset = 0;
+  }
+
+  recvBufferCb(w->id, data, size, offset, length);
+}
+
+// The $sendValue function. Serializes its argument with V8's ValueSerializer
+// and passes the result to the worker's ValueCallback in Go, which decodes it.
+// If the value can't be serialized, or Go returns an error, an exception is
+// thrown.
+void SendValue(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  assert(w->isolate == isolate);
+
+  if (w->snapshotting) {
+    isolate->ThrowException(String::NewFromUtf8(
+        isolate, "v8worker: $sendValue is not available in snapshots"));
+    return;
+  }
+
+  ValueSerializer serializer(isolate);
+  serializer.WriteHeader();
+  if (!serializer.WriteValue(isolate->GetCurrentContext(), args[0])
+           .FromMaybe(false)) {
+    return;
+  }
+  std::pair<uint8_t*, size_t> data = serializer.Release();
+  char* err = recvValueCb(w->id, data.first, data.second);
+  free(data.first);
+  if (err != NULL) {
+    isolate->ThrowException(
+        Exception::Error(String::NewFromUtf8(isolate, err)));
+    free(err);
+  }
+}
+
+// The $sendJSON function. Serializes its argument with V8's native JSON
+// serializer and passes the result to the worker's JSONCallback in Go. If the
+// value can't be serialized, or Go returns an error, an exception is thrown.
+void SendJSON(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  assert(w->isolate == isolate);
+
+  if (w->snapshotting) {
+    isolate->ThrowException(String::NewFromUtf8(
+        isolate, "v8worker: $sendJSON is not available in snapshots"));
+    return;
+  }
+
+  // JSON.stringify returns undefined for these rather than a string.
+  if (args[0]->IsUndefined() || args[0]->IsFunction() || args[0]->IsSymbol()) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(
+        isolate, "v8worker: value can't be represented as JSON")));
+    return;
+  }
+
+  Local<String> json;
+  if (!JSON::Stringify(isolate->GetCurrentContext(), args[0]).ToLocal(&json)) {
+    return;
+  }
+  WriteUtf8(json, &w->send_buffer);
+  char* err = recvJSONCb(w->id, (char*)w->send_buffer.data(),
+                         w->send_buffer.size());
+  if (err != NULL) {
+    isolate->ThrowException(
+        Exception::Error(String::NewFromUtf8(isolate, err)));
+    free(err);
+  }
+}
+
+// Closes a channel whose inbound ring holds a frame that doesn't fit within
+// the data that Go has written, and tells Go that it's unusable.
+void PoisonChannel(worker_channel* c) {
   {
-    Isolate* isolate = args.GetIsolate();
-    w = static_cast<worker*>(isolate->GetData(0));
-    assert(w->isolate == isolate);
+    std::lock_guard<std::mutex> lock(c->mutex);
+    c->closed = true;
+    c->cond.notify_all();
+  }
+  channelWakeCb(c->w->id, 2);
+}
 
-    Locker locker(w->isolate);
-    HandleScope handle_scope(isolate);
+// The $channel.read function. Returns the next message from Go, waiting for up
+// to the given number of milliseconds, or indefinitely if no timeout is given.
+// Returns null on timeout or once the channel has been closed and drained. The
+// frame lengths in the ring aren't trusted: a frame that doesn't fit within
+// the data written so far poisons the channel and raises an exception.
+void ChannelRead(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker_channel* c =
+      static_cast<worker_channel*>(Local<External>::Cast(args.Data())->Value());
+  RingHeader* ring = reinterpret_cast<RingHeader*>(c->inbound);
+  char* data = c->inbound + sizeof(RingHeader);
+
+  double timeout_ms = -1;
+  if (args[0]->IsNumber()) {
+    timeout_ms = args[0].As<Number>()->Value();
+  }
 
-    Local<Context> context = Local<Context>::New(w->isolate, w->context);
-    Context::Scope context_scope(context);
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (ring->head.load() == tail) {
+    ChannelWait(c, ring->consumer_waiting, timeout_ms,
+                [&] { return ring->head.load() != tail; });
+    if (ring->head.load() == tail) {
+      args.GetReturnValue().SetNull();
+      return;
+    }
+  }
+
+  uint32_t available = ring->head.load() - tail;
+  uint32_t length = 0;
+  if (available >= 4 && available <= c->capacity) {
+    RingCopyOut(data, c->capacity, tail, reinterpret_cast<char*>(&length), 4);
+  }
+  if (available < 4 || available > c->capacity || length > c->capacity - 4 ||
+      RingFrameSize(length) > available) {
+    PoisonChannel(c);
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "v8worker: $channel is corrupt")));
+    return;
+  }
+  std::string& msg = c->w->send_buffer;
+  msg.resize(length);
+  RingCopyOut(data, c->capacity, tail + 4, &msg[0], length);
+  ring->tail.store(tail + RingFrameSize(length));
+  if (ring->producer_waiting.load()) {
+    channelWakeCb(c->w->id, 0);
+  }
+
+  Local<String> str;
+  if (String::NewFromUtf8(isolate, msg.data(), NewStringType::kNormal, length)
+          .ToLocal(&str)) {
+    args.GetReturnValue().Set(str);
+  }
+}
+
+// The $channel.write function. Writes a message for Go, waiting for space in
+// the ring if need be.
+void ChannelWrite(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  worker_channel* c =
+      static_cast<worker_channel*>(Local<External>::Cast(args.Data())->Value());
+  RingHeader* ring = reinterpret_cast<RingHeader*>(c->outbound);
+  char* data = c->outbound + sizeof(RingHeader);
+
+  if (!args[0]->IsString()) {
+    isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(
+        isolate, "v8worker: $channel.write expects a string")));
+    return;
+  }
+  std::string& msg = c->w->send_buffer;
+  WriteUtf8(Local<String>::Cast(args[0]), &msg);
+  uint32_t length = msg.size();
+  uint32_t frame = RingFrameSize(length);
+  if (msg.size() > c->capacity || frame > c->capacity) {
+    isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(
+        isolate, "v8worker: message too large for $channel")));
+    return;
+  }
+
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  auto fits = [&] { return c->capacity - (head - ring->tail.load()) >= frame; };
+  if (!fits()) {
+    ChannelWait(c, ring->producer_waiting, -1, fits);
+  }
+  if (c->closed.load()) {
+    isolate->ThrowException(Exception::Error(
+        String::NewFromUtf8(isolate, "v8worker: $channel has been closed")));
+    return;
+  }
+
+  RingCopyIn(data, c->capacity, head, reinterpret_cast<char*>(&length), 4);
+  RingCopyIn(data, c->capacity, head + 4, msg.data(), length);
+  ring->head.store(head + frame);
+  if (ring->consumer_waiting.load()) {
+    channelWakeCb(c->w->id, 1);
+  }
+}
+
+// Exposes the worker's channel to the given context as $channel.
+void InstallChannel(worker* w, Local<Context> context) {
+  Context::Scope context_scope(context);
+  Local<External> data = External::New(w->isolate, w->channel);
+  Local<Object> channel = Object::New(w->isolate);
+  channel
+      ->Set(context, String::NewFromUtf8(w->isolate, "read"),
+            Function::New(context, ChannelRead, data).ToLocalChecked())
+      .FromJust();
+  channel
+      ->Set(context, String::NewFromUtf8(w->isolate, "write"),
+            Function::New(context, ChannelWrite, data).ToLocalChecked())
+      .FromJust();
+  context->Global()
+      ->Set(context, String::NewFromUtf8(w->isolate, "$channel"), channel)
+      .FromJust();
+}
+
+// The native callbacks referenced by the global template. V8 needs these to
+// rewire the function templates when deserializing a snapshot.
+intptr_t external_references[] = {reinterpret_cast<intptr_t>(Print),
+                                  reinterpret_cast<intptr_t>(Recv),
+                                  reinterpret_cast<intptr_t>(RecvSync),
+                                  reinterpret_cast<intptr_t>(Send),
+                                  reinterpret_cast<intptr_t>(SendSync),
+                                  reinterpret_cast<intptr_t>(SendBuffer),
+                                  reinterpret_cast<intptr_t>(SendValue),
+                                  reinterpret_cast<intptr_t>(SendAsync),
+                                  reinterpret_cast<intptr_t>(SendJSON),
+                                  0};
+
+// The private keys under which the $recv and $recvSync callbacks are stashed
+// on the global object while creating a snapshot.
+Local<Private> RecvKey(Isolate* isolate) {
+  return Private::ForApi(isolate,
+                         String::NewFromUtf8(isolate, "v8worker:recv"));
+}
+
+Local<Private> RecvSyncKey(Isolate* isolate) {
+  return Private::ForApi(isolate,
+                         String::NewFromUtf8(isolate, "v8worker:recvSync"));
+}
+
+Local<ObjectTemplate> NewGlobalTemplate(Isolate* isolate, int enable_print) {
+  Local<ObjectTemplate> global = ObjectTemplate::New(isolate);
+
+  if (enable_print) {
+    global->Set(String::NewFromUtf8(isolate, "$print"),
+                FunctionTemplate::New(isolate, Print));
+  }
+
+  global->Set(String::NewFromUtf8(isolate, "$recv"),
+              FunctionTemplate::New(isolate, Recv));
+
+  global->Set(String::NewFromUtf8(isolate, "$send"),
+              FunctionTemplate::New(isolate, Send));
 
-    Local<Value> v = args[0];
-    assert(v->IsString());
+  global->Set(String::NewFromUtf8(isolate, "$sendSync"),
+              FunctionTemplate::New(isolate, SendSync));
 
-    String::Utf8Value str(v);
-    msg = ToCString(str);
+  global->Set(String::NewFromUtf8(isolate, "$recvSync"),
+              FunctionTemplate::New(isolate, RecvSync));
+
+  global->Set(String::NewFromUtf8(isolate, "$sendAsync"),
+              FunctionTemplate::New(isolate, SendAsync));
+
+  global->Set(String::NewFromUtf8(isolate, "$sendJSON"),
+              FunctionTemplate::New(isolate, SendJSON));
+
+  global->Set(String::NewFromUtf8(isolate, "$sendBuffer"),
+              FunctionTemplate::New(isolate, SendBuffer));
+
+  global->Set(String::NewFromUtf8(isolate, "$sendValue"),
+              FunctionTemplate::New(isolate, SendValue));
+
+  return global;
+}
+
+// Moves a callback stashed by worker_create_snapshot back into the worker.
+void RestoreHandler(Isolate* isolate,
+                    Local<Context> context,
+                    Local<Private> key,
+                    Persistent<Function>& handler) {
+  Local<Object> global = context->Global();
+  Local<Value> v;
+  if (!global->GetPrivate(context, key).ToLocal(&v) || !v->IsFunction()) {
+    return;
   }
-  char* returnMsg = recvSyncCb(w->id, (char*)msg.c_str());
-  Local<String> returnV = String::NewFromUtf8(w->isolate, returnMsg);
-  args.GetReturnValue().Set(returnV);
-  free(returnMsg);
+  handler.Reset(isolate, Local<Function>::Cast(v));
+  global->DeletePrivate(context, key).FromJust();
 }
 
 void v8_init() {
-  const char* options = "--harmony_public_fields --harmony_private_fields";
+  const char* options =
+      "--harmony_public_fields --harmony_private_fields "
+      "--harmony_dynamic_import";
   V8::SetFlagsFromString(options, strlen(options));
-  Platform* platform = platform::CreateDefaultPlatform();
-  V8::InitializePlatform(platform);
+  default_platform = platform::CreateDefaultPlatform();
+  V8::InitializePlatform(default_platform);
   V8::Initialize();
 }
 
+// Creates a startup snapshot containing the global bindings and the state left
+// behind by running the given bootstrap script. A non-zero return value
+// indicates error, in which case err is set to a malloc'd description.
+int worker_create_snapshot(char* name_s,
+                           char* source_s,
+                           int enable_print,
+                           worker_snapshot* snapshot,
+                           const char** err) {
+  worker w;
+  w.id = 0;
+  w.batch_module_fetch = false;
+  w.resolve_module_urls = false;
+  w.snapshotting = true;
+  w.snapshot.data = NULL;
+  w.snapshot.raw_size = 0;
+  w.module_stats = worker_module_stats();
+  w.send_queue = NULL;
+  w.channel = NULL;
+  w.last_request_id = 0;
+  w.owner = NULL;
+  w.allocator = NULL;
+  w.max_stack_bytes = 0;
+  w.heap_limit_reached = false;
+  w.initial_heap_limit = 0;
+
+  int ret = 0;
+  StartupData blob;
+  {
+    SnapshotCreator creator(external_references);
+    Isolate* isolate = creator.GetIsolate();
+    w.isolate = isolate;
+    isolate->SetCaptureStackTraceForUncaughtExceptions(true);
+    isolate->SetData(0, &w);
+    {
+      HandleScope handle_scope(isolate);
+      Local<Context> context =
+          Context::New(isolate, NULL, NewGlobalTemplate(isolate, enable_print));
+      context->SetAlignedPointerInEmbedderData(2, NULL);
+      w.context.Reset(isolate, context);
+      Context::Scope context_scope(context);
+
+      TryCatch try_catch(isolate);
+
+      Local<String> name = String::NewFromUtf8(isolate, name_s);
+      Local<String> source = String::NewFromUtf8(isolate, source_s);
+      ScriptOrigin origin(name);
+
+      Local<Script> script;
+      if (!Script::Compile(context, source, &origin).ToLocal(&script)) {
+        *err = CopyString(ExceptionString(isolate, context, &try_catch));
+        ret = 1;
+      } else if (script->Run(context).IsEmpty()) {
+        *err = CopyString(ExceptionString(isolate, context, &try_catch));
+        ret = 2;
+      }
+
+      // Persistent handles can't be serialized, so the handlers registered by
+      // the bootstrap script are stashed on the global object instead.
+      Local<Object> global = context->Global();
+      if (!w.recv.IsEmpty()) {
+        global
+            ->SetPrivate(context, RecvKey(isolate),
+                         Local<Function>::New(isolate, w.recv))
+            .FromJust();
+      }
+      if (!w.recv_sync_handler.IsEmpty()) {
+        global
+            ->SetPrivate(context, RecvSyncKey(isolate),
+                         Local<Function>::New(isolate, w.recv_sync_handler))
+            .FromJust();
+      }
+      w.recv.Reset();
+      w.recv_sync_handler.Reset();
+      w.context.Reset();
+
+      creator.SetDefaultContext(context);
+    }
+    // Keep the compiled bootstrap code so that it isn't recompiled on first
+    // use within each worker.
+    blob = creator.CreateBlob(SnapshotCreator::FunctionCodeHandling::kKeep);
+  }
+
+  if (ret != 0) {
+    delete[] blob.data;
+    return ret;
+  }
+  if (blob.data == NULL) {
+    *err = CopyString("v8worker: failed to create snapshot");
+    return 3;
+  }
+
+  snapshot->data = blob.data;
+  snapshot->size = blob.raw_size;
+  return 0;
+}
+
+void worker_snapshot_dispose(worker_snapshot* snapshot) {
+  delete[] snapshot->data;
+  snapshot->data = NULL;
+  snapshot->size = 0;
+}
+
+// Forgets the $sendAsync requests made from within the given context, so that
+// attempts to settle them are ignored.
+void DropPendingRequests(worker* w, int ctx) {
+  for (auto it = w->pending_requests.begin();
+       it != w->pending_requests.end();) {
+    if (it->second.ctx == ctx) {
+      it = w->pending_requests.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void DisposeTenant(worker_context* c) {
+  Isolate* isolate = c->w->isolate;
+  HandleScope handle_scope(isolate);
+  DropPendingRequests(c->w, c->id);
+  DisposeModuleData(Local<Context>::New(isolate, c->context));
+  c->recv.Reset();
+  c->recv_sync_handler.Reset();
+  c->context.Reset();
+  delete c;
+  isolate->ContextDisposedNotification();
+}
+
 void worker_dispose(worker* w) {
+  assert(w->owner == NULL);
+  {
+    Locker locker(w->isolate);
+    Isolate::Scope isolate_scope(w->isolate);
+    HandleScope handle_scope(w->isolate);
+    for (auto& it : w->tenants) {
+      DisposeTenant(it.second);
+    }
+    w->tenants.clear();
+    w->scripts.clear();
+    w->pending_requests.clear();
+    DisposeModuleData(Local<Context>::New(w->isolate, w->context));
+  }
   w->isolate->Dispose();
+  if (w->channel != NULL) {
+    free(w->channel->inbound);
+    free(w->channel->outbound);
+    delete w->channel;
+  }
+  delete w->send_queue;
+  delete w->allocator;
   delete (w);
 }
 
 const char* worker_last_exception(worker* w) {
+  if (w->heap_limit_reached) {
+    return CopyString(
+        "v8worker: worker was terminated after reaching its heap limit");
+  }
   return CopyString(w->last_exception);
 }
 
-int worker_load_module(worker* w, char* url_s) {
+// Returns whether the worker has failed by reaching its heap limit, after
+// which any calls into it are terminated.
+int worker_heap_limit_reached(worker* w) {
+  return w->heap_limit_reached;
+}
+
+// Loads and evaluates the module with the given url. If batch is non-zero, the
+// sources for each level of the module graph are fetched with a single call.
+int worker_load_module(worker* w, char* url_s, int batch) {
   Locker locker(w->isolate);
   Isolate::Scope isolate_scope(w->isolate);
   HandleScope handle_scope(w->isolate);
@@ -314,7 +1804,7 @@ int worker_load_module(worker* w, char* url_s) {
 
   Local<String> url = String::NewFromUtf8(w->isolate, url_s);
   MaybeLocal<Module> mod;
-  LoadModule(w, context, url, mod);
+  LoadModule(w, context, url, batch, mod);
 
   Local<Module> module;
   if (!mod.ToLocal(&module)) {
@@ -339,29 +1829,96 @@ int worker_load_module(worker* w, char* url_s) {
   return 0;
 }
 
-int worker_load_script(worker* w, char* name_s, char* source_s) {
+// Fetches and compiles the module graph with the given url without evaluating
+// it, so that a later import() of the module doesn't have to. The graph is
+// fetched a level at a time if the worker was created with batch_module_fetch.
+int worker_prefetch_module(worker* w, char* url_s) {
   Locker locker(w->isolate);
   Isolate::Scope isolate_scope(w->isolate);
   HandleScope handle_scope(w->isolate);
 
   Local<Context> context = Local<Context>::New(w->isolate, w->context);
   Context::Scope context_scope(context);
+  TryCatch try_catch(w->isolate);
+
+  Local<String> url = String::NewFromUtf8(w->isolate, url_s);
+  MaybeLocal<Module> mod;
+  LoadModule(w, context, url, w->batch_module_fetch, mod);
+  if (mod.IsEmpty()) {
+    w->last_exception = ExceptionString(w->isolate, context, &try_catch);
+    return 1;
+  }
+  return 0;
+}
+
+// Looks up the code cache for the given key, first in memory and then through
+// the disk cache managed by Go.
+CodeCache::Data LookupCodeCache(char* key_s) {
+  CodeCache::Data data = code_cache.Get(key_s);
+  if (data) {
+    code_cache.memory_hits++;
+    return data;
+  }
+  int size = 0;
+  void* buf = readCodeCache(key_s, &size);
+  if (buf == NULL) {
+    code_cache.misses++;
+    return nullptr;
+  }
+  data = std::make_shared<const std::string>((char*)buf, size);
+  free(buf);
+  code_cache.disk_hits++;
+  code_cache.Put(key_s, data);
+  return data;
+}
+
+// Compiles and runs a script within the given context. If key_s is not NULL,
+// the compiled code is looked up in, and otherwise added to, the code cache
+// under that key. Must be called with the isolate locked and entered.
+int LoadScript(worker* w,
+               Local<Context> context,
+               char* name_s,
+               char* source_s,
+               char* key_s) {
+  HandleScope handle_scope(w->isolate);
+  Context::Scope context_scope(context);
 
   TryCatch try_catch(w->isolate);
 
   Local<String> name = String::NewFromUtf8(w->isolate, name_s);
-  Local<String> source = String::NewFromUtf8(w->isolate, source_s);
+  Local<String> source_text = String::NewFromUtf8(w->isolate, source_s);
 
   ScriptOrigin origin(name);
 
-  Local<Script> script = Script::Compile(source, &origin);
+  CodeCache::Data cached;
+  ScriptCompiler::CachedData* cached_data = NULL;
+  ScriptCompiler::CompileOptions options = ScriptCompiler::kNoCompileOptions;
+  if (key_s != NULL) {
+    cached = LookupCodeCache(key_s);
+    if (cached) {
+      cached_data = new ScriptCompiler::CachedData(
+          (const uint8_t*)cached->data(), cached->size());
+      options = ScriptCompiler::kConsumeCodeCache;
+    }
+  }
+  ScriptCompiler::Source source(source_text, origin, cached_data);
 
-  if (script.IsEmpty()) {
+  Local<Script> script;
+  if (!ScriptCompiler::Compile(context, &source, options).ToLocal(&script)) {
     assert(try_catch.HasCaught());
     w->last_exception = ExceptionString(w->isolate, context, &try_catch);
     return 1;
   }
 
+  // V8 rejects code caches created by a different version or with different
+  // flags, in which case the entry is regenerated.
+  bool produce = key_s != NULL && !cached;
+  if (cached && source.GetCachedData()->rejected) {
+    code_cache.rejects++;
+    code_cache.Remove(key_s);
+    produce = true;
+  }
+
   Handle<Value> result = script->Run();
 
   if (result.IsEmpty()) {
@@ -370,55 +1927,87 @@ int worker_load_script(worker* w, char* name_s, char* source_s) {
     return 2;
   }
 
+  // The code cache is created after running the script so that it includes
+  // any functions that were lazily compiled during its execution.
+  if (produce) {
+    Local<UnboundScript> unbound = script->GetUnboundScript();
+    ScriptCompiler::CachedData* data =
+        ScriptCompiler::CreateCodeCache(unbound, source_text);
+    if (data != NULL) {
+      CodeCache::Data buf = std::make_shared<const std::string>(
+          (const char*)data->data, data->length);
+      delete data;
+      code_cache.Put(key_s, buf);
+      writeCodeCache(key_s, (void*)buf->data(), buf->size());
+    }
+  }
+
   return 0;
 }
 
-worker* worker_init(int id, int enable_print) {
-  worker* w = new (worker);
-
-  Isolate::CreateParams create_params;
-  create_params.array_buffer_allocator =
-      ArrayBuffer::Allocator::NewDefaultAllocator();
-  Isolate* isolate = Isolate::New(create_params);
-  Locker locker(isolate);
-  Isolate::Scope isolate_scope(isolate);
-  HandleScope handle_scope(isolate);
-
-  w->isolate = isolate;
-  w->isolate->SetCaptureStackTraceForUncaughtExceptions(true);
-  w->isolate->SetData(0, w);
-  w->id = id;
+int worker_load_script(worker* w, char* name_s, char* source_s) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
 
-  Local<ObjectTemplate> global = ObjectTemplate::New(w->isolate);
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  return LoadScript(w, context, name_s, source_s, NULL);
+}
 
-  if (enable_print) {
-    global->Set(String::NewFromUtf8(w->isolate, "$print"),
-                FunctionTemplate::New(w->isolate, Print));
+// Starts loading a script whose source will be written in chunks with
+// worker_script_stream_write. The script is parsed on a background thread as
+// the chunks arrive, and is compiled and run by worker_script_stream_finish.
+// The isolate stays locked by the calling thread until then, so all of the
+// stream's calls must be made from that thread, and calls from other threads
+// block until the stream has finished.
+worker_script_stream* worker_load_script_stream(worker* w, char* name_s) {
+  worker_script_stream* s = new (worker_script_stream);
+  s->locker.reset(new Locker(w->isolate));
+  s->w = w;
+  s->name = name_s;
+  s->ascii = true;
+  s->stream = new ChunkedSourceStream();
+  s->source.reset(new ScriptCompiler::StreamedSource(
+      s->stream, ScriptCompiler::StreamedSource::UTF8));
+  {
+    Isolate::Scope isolate_scope(w->isolate);
+    s->task.reset(
+        ScriptCompiler::StartStreamingScript(w->isolate, s->source.get()));
   }
+  ScriptCompiler::ScriptStreamingTask* task = s->task.get();
+  s->parser = std::thread([task] { task->Run(); });
+  return s;
+}
 
-  global->Set(String::NewFromUtf8(w->isolate, "$recv"),
-              FunctionTemplate::New(w->isolate, Recv));
-
-  global->Set(String::NewFromUtf8(w->isolate, "$send"),
-              FunctionTemplate::New(w->isolate, Send));
-
-  global->Set(String::NewFromUtf8(w->isolate, "$sendSync"),
-              FunctionTemplate::New(w->isolate, SendSync));
-
-  global->Set(String::NewFromUtf8(w->isolate, "$recvSync"),
-              FunctionTemplate::New(w->isolate, RecvSync));
-
-  Local<Context> context = Context::New(w->isolate, NULL, global);
-  w->context.Reset(w->isolate, context);
-
-  InitModuleData(context);
-  return w;
+// Appends a chunk of UTF-8 source to the stream. Chunks may split multi-byte
+// characters.
+void worker_script_stream_write(worker_script_stream* s,
+                                const char* data,
+                                int length) {
+  if (s->ascii) {
+    for (int i = 0; i < length; i++) {
+      if (data[i] & 0x80) {
+        s->ascii = false;
+        break;
+      }
+    }
+  }
+  s->text.append(data, length);
+  s->stream->Push(data, length);
 }
 
-// Called from Go to send messages to JavaScript. It will call the callback
-// registered with $recv. A non-zero return value indicates error. Check
-// worker_last_exception().
-int worker_send(worker* w, const char* msg) {
+// Ends the stream, then compiles and runs the script, unless abort is
+// non-zero. The stream is freed. A non-zero return value indicates error.
+// Check worker_last_exception().
+int worker_script_stream_finish(worker_script_stream* s, int abort) {
+  std::unique_ptr<worker_script_stream> owned(s);
+  s->stream->Close();
+  s->parser.join();
+  if (abort) {
+    return 0;
+  }
+
+  worker* w = s->w;
   Locker locker(w->isolate);
   Isolate::Scope isolate_scope(w->isolate);
   HandleScope handle_scope(w->isolate);
@@ -428,20 +2017,24 @@ int worker_send(worker* w, const char* msg) {
 
   TryCatch try_catch(w->isolate);
 
-  Local<Function> recv = Local<Function>::New(w->isolate, w->recv);
-  if (recv.IsEmpty()) {
-    w->last_exception = "v8worker: callback not registered with $recv";
+  // V8 still needs the full source, e.g. to lazily compile functions. ASCII
+  // sources are handed over without being copied onto the heap.
+  ModuleSourceStore::Source full(
+      new SharedSource{std::move(s->text), s->ascii});
+  Local<String> source_text = NewSharedSourceString(w->isolate, full);
+  Local<String> name = String::NewFromUtf8(w->isolate, s->name.c_str());
+  ScriptOrigin origin(name);
+
+  Local<Script> script;
+  if (!ScriptCompiler::Compile(context, s->source.get(), source_text, origin)
+           .ToLocal(&script)) {
+    assert(try_catch.HasCaught());
+    w->last_exception = ExceptionString(w->isolate, context, &try_catch);
     return 1;
   }
 
-  Local<Value> args[1];
-  args[0] = String::NewFromUtf8(w->isolate, msg);
-
-  assert(!try_catch.HasCaught());
-
-  recv->Call(context->Global(), 1, args);
-
-  if (try_catch.HasCaught()) {
+  if (script->Run(context).IsEmpty()) {
+    assert(try_catch.HasCaught());
     w->last_exception = ExceptionString(w->isolate, context, &try_catch);
     return 2;
   }
@@ -449,10 +2042,15 @@ int worker_send(worker* w, const char* msg) {
   return 0;
 }
 
-// Called from Go to send messages to JavaScript. It will call the callback
-// registered with $recvSync and return its string value.
-const char* worker_send_sync(worker* w, const char* msg) {
-  std::string out;
+// Loads the given scripts, parsing and compiling them concurrently on the
+// platform's worker threads and then running them in order. If a script fails,
+// the remaining scripts are not run, and its index is stored in failed. A
+// non-zero return value indicates error. Check worker_last_exception().
+int worker_load_scripts(worker* w,
+                        int count,
+                        char** names,
+                        char** sources,
+                        int* failed) {
   Locker locker(w->isolate);
   Isolate::Scope isolate_scope(w->isolate);
   HandleScope handle_scope(w->isolate);
@@ -460,25 +2058,987 @@ const char* worker_send_sync(worker* w, const char* msg) {
   Local<Context> context = Local<Context>::New(w->isolate, w->context);
   Context::Scope context_scope(context);
 
-  Local<Function> recv_sync_handler =
-      Local<Function>::New(w->isolate, w->recv_sync_handler);
-  if (recv_sync_handler.IsEmpty()) {
-    out.append("v8worker: callback not registered with $recvSync");
-    return CopyString(out);
+  std::vector<std::unique_ptr<ScriptCompiler::StreamedSource>> streamed;
+  std::vector<std::unique_ptr<ScriptCompiler::ScriptStreamingTask>> tasks;
+  Latch latch(count);
+  for (int i = 0; i < count; i++) {
+    ChunkedSourceStream* stream = new ChunkedSourceStream();
+    stream->Push(sources[i], strlen(sources[i]));
+    stream->Close();
+    streamed.emplace_back(new ScriptCompiler::StreamedSource(
+        stream, ScriptCompiler::StreamedSource::UTF8));
+    tasks.emplace_back(
+        ScriptCompiler::StartStreamingScript(w->isolate, streamed[i].get()));
+    default_platform->CallOnBackgroundThread(
+        new BackgroundCompileTask(tasks[i].get(), &latch),
+        Platform::kShortRunningTask);
   }
+  latch.Wait();
 
-  Local<Value> args[1];
-  args[0] = String::NewFromUtf8(w->isolate, msg);
-  Local<Value> response_value =
-      recv_sync_handler->Call(context->Global(), 1, args);
+  TryCatch try_catch(w->isolate);
+  for (int i = 0; i < count; i++) {
+    HandleScope handle_scope(w->isolate);
+    Local<String> name = String::NewFromUtf8(w->isolate, names[i]);
+    Local<String> source_text = String::NewFromUtf8(w->isolate, sources[i]);
+    ScriptOrigin origin(name);
+
+    Local<Script> script;
+    if (!ScriptCompiler::Compile(context, streamed[i].get(), source_text,
+                                 origin)
+             .ToLocal(&script)) {
+      assert(try_catch.HasCaught());
+      w->last_exception = ExceptionString(w->isolate, context, &try_catch);
+      *failed = i;
+      return 1;
+    }
 
-  if (response_value->IsString()) {
-    String::Utf8Value response(response_value->ToString());
-    out.append(*response);
-  } else {
-    out.append("v8worker: non-string return value");
+    if (script->Run(context).IsEmpty()) {
+      assert(try_catch.HasCaught());
+      w->last_exception = ExceptionString(w->isolate, context, &try_catch);
+      *failed = i;
+      return 2;
+    }
   }
-  return CopyString(out);
+
+  return 0;
+}
+
+// Like worker_load_script, but uses the process-wide code cache with the given
+// key, which should be a digest of the source.
+int worker_load_script_cached(worker* w,
+                              char* name_s,
+                              char* source_s,
+                              char* key_s) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  return LoadScript(w, context, name_s, source_s, key_s);
+}
+
+void worker_code_cache_configure(size_t capacity) {
+  code_cache.SetCapacity(capacity);
+}
+
+void worker_code_cache_get_stats(worker_code_cache_stats* stats) {
+  stats->memory_hits = code_cache.memory_hits;
+  stats->disk_hits = code_cache.disk_hits;
+  stats->misses = code_cache.misses;
+  stats->rejects = code_cache.rejects;
+}
+
+// Compiles a context-independent script that can then be run within any of the
+// worker's contexts using worker_run_script or worker_context_run_script. It
+// returns the id of the script, or -1 on error.
+int worker_compile_script(worker* w, char* name_s, char* source_s) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+
+  TryCatch try_catch(w->isolate);
+
+  Local<String> name = String::NewFromUtf8(w->isolate, name_s);
+  Local<String> source_text = String::NewFromUtf8(w->isolate, source_s);
+
+  ScriptOrigin origin(name);
+  ScriptCompiler::Source source(source_text, origin);
+
+  Local<UnboundScript> script;
+  if (!ScriptCompiler::CompileUnboundScript(w->isolate, &source)
+           .ToLocal(&script)) {
+    w->last_exception = ExceptionString(w->isolate, context, &try_catch);
+    return -1;
+  }
+
+  w->scripts.emplace_back(w->isolate, script);
+  return w->scripts.size() - 1;
+}
+
+// Binds a script compiled with worker_compile_script to the given context and
+// runs it. Must be called with the isolate locked and entered.
+int RunScript(worker* w, Local<Context> context, int script_id) {
+  HandleScope handle_scope(w->isolate);
+  Context::Scope context_scope(context);
+
+  if (script_id < 0 || (size_t)script_id >= w->scripts.size()) {
+    w->last_exception = "v8worker: unknown script";
+    return 1;
+  }
+
+  TryCatch try_catch(w->isolate);
+
+  Local<Script> script =
+      w->scripts[script_id].Get(w->isolate)->BindToCurrentContext();
+  if (script->Run(context).IsEmpty()) {
+    assert(try_catch.HasCaught());
+    w->last_exception = ExceptionString(w->isolate, context, &try_catch);
+    return 2;
+  }
+
+  return 0;
+}
+
+int worker_run_script(worker* w, int script_id) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  return RunScript(w, context, script_id);
+}
+
+// Creates a fresh context for the worker, either from its snapshot or from its
+// global template. If tenant is NULL, the context is for the worker itself.
+// Must be called with the isolate locked and entered.
+Local<Context> NewWorkerContext(worker* w, worker_context* tenant) {
+  EscapableHandleScope handle_scope(w->isolate);
+  Persistent<Function>& recv = tenant ? tenant->recv : w->recv;
+  Persistent<Function>& recv_sync_handler =
+      tenant ? tenant->recv_sync_handler : w->recv_sync_handler;
+
+  Local<Context> context;
+  if (w->snapshot.data != NULL) {
+    context = Context::New(w->isolate);
+    Context::Scope context_scope(context);
+    RestoreHandler(w->isolate, context, RecvKey(w->isolate), recv);
+    RestoreHandler(w->isolate, context, RecvSyncKey(w->isolate),
+                   recv_sync_handler);
+  } else {
+    Local<ObjectTemplate> global =
+        Local<ObjectTemplate>::New(w->isolate, w->global_template);
+    context = Context::New(w->isolate, NULL, global);
+  }
+  context->SetSecurityToken(Integer::New(w->isolate, tenant ? tenant->id : 0));
+  context->SetAlignedPointerInEmbedderData(2, tenant);
+  InitModuleData(context);
+  return handle_scope.Escape(context);
+}
+
+// Called by V8 when the worker's heap is close to its limit. Rather than
+// letting V8 abort the process, the worker is terminated and marked as failed,
+// and the limit is raised to give the script room to unwind, up to twice the
+// initial limit. worker_reset restores the initial limit.
+size_t NearHeapLimit(void* data,
+                     size_t current_heap_limit,
+                     size_t initial_heap_limit) {
+  worker* w = static_cast<worker*>(data);
+  w->heap_limit_reached = true;
+  w->initial_heap_limit = initial_heap_limit;
+  w->isolate->TerminateExecution();
+  if (current_heap_limit >= 2 * initial_heap_limit) {
+    return current_heap_limit;
+  }
+  return current_heap_limit + initial_heap_limit / 4;
+}
+
+// Called by V8 before it enters JavaScript from outside of it. Terminates
+// every call into a worker that has failed.
+void BeforeCallEntered(Isolate* isolate) {
+  worker* w = static_cast<worker*>(isolate->GetData(0));
+  if (w->heap_limit_reached) {
+    isolate->TerminateExecution();
+  }
+}
+
+// Called by V8 when an allocation fails. V8 aborts the process once this
+// returns, so the most that can be done is to say which worker was at fault.
+void OutOfMemory(const char* location, bool is_heap_oom) {
+  Isolate* isolate = Isolate::GetCurrent();
+  int id = isolate != NULL ? static_cast<worker*>(isolate->GetData(0))->id : 0;
+  fprintf(stderr, "v8worker: worker %d ran out of %s memory in %s\n", id,
+          is_heap_oom ? "heap" : "process", location);
+}
+
+// Creates a new worker. If resolve_module_urls is non-zero, module specifiers
+// are resolved by calling into Go. If batch_module_fetch is non-zero, the
+// module graphs of import() expressions are fetched a level at a time. If
+// snapshot is not NULL, the isolate and its context are deserialized from it,
+// and enable_print is ignored in favour of the setting used when the snapshot
+// was created. The snapshot data must outlive the worker. Zero fields of limits
+// leave V8's defaults in place, and limits may be NULL.
+
+worker* worker_init(int id,
+                    int enable_print,
+                    int resolve_module_urls,
+                    int batch_module_fetch,
+                    worker_snapshot* snapshot,
+                    const worker_limits* limits) {
+  worker* w = new (worker);
+  w->batch_module_fetch = batch_module_fetch;
+  w->resolve_module_urls = resolve_module_urls;
+  w->snapshotting = false;
+  w->module_stats = worker_module_stats();
+  w->send_queue = NULL;
+  w->channel = NULL;
+  w->last_request_id = 0;
+  w->owner = NULL;
+  w->allocator =
+      new WorkerAllocator(limits != NULL ? limits->max_array_buffer_bytes : 0);
+  w->max_stack_bytes = limits != NULL ? limits->max_stack_bytes : 0;
+  w->heap_limit_reached = false;
+  w->initial_heap_limit = 0;
+
+  Isolate::CreateParams create_params;
+  create_params.array_buffer_allocator = w->allocator;
+  if (limits != NULL && limits->max_old_generation_bytes != 0) {
+    create_params.constraints.set_max_old_space_size(
+        std::max<size_t>(limits->max_old_generation_bytes >> 20, 1));
+  }
+  if (limits != NULL && limits->max_young_generation_bytes != 0) {
+    // The young generation is made up of two semi-spaces.
+    create_params.constraints.set_max_semi_space_size_in_kb(
+        std::max<size_t>(limits->max_young_generation_bytes / 2 >> 10, 1));
+  }
+  if (snapshot != NULL) {
+    w->snapshot.data = snapshot->data;
+    w->snapshot.raw_size = snapshot->size;
+    create_params.snapshot_blob = &w->snapshot;
+    create_params.external_references = external_references;
+  } else {
+    w->snapshot.data = NULL;
+    w->snapshot.raw_size = 0;
+  }
+  Isolate* isolate = Isolate::New(create_params);
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  w->isolate = isolate;
+  w->isolate->SetCaptureStackTraceForUncaughtExceptions(true);
+  w->isolate->SetData(0, w);
+  w->isolate->SetHostImportModuleDynamicallyCallback(ImportModuleDynamically);
+  w->isolate->AddNearHeapLimitCallback(NearHeapLimit, w);
+  w->isolate->AddBeforeCallEnteredCallback(BeforeCallEntered);
+  w->isolate->SetOOMErrorHandler(OutOfMemory);
+  w->id = id;
+
+  if (snapshot == NULL) {
+    w->global_template.Reset(w->isolate,
+                             NewGlobalTemplate(w->isolate, enable_print));
+  }
+  w->context.Reset(w->isolate, NewWorkerContext(w, NULL));
+  return w;
+}
+
+// Makes $send queue its messages and hand them to Go in batches. The queue is
+// flushed whenever control returns from JavaScript, or within a call once it
+// holds flush_size messages or flush_bytes bytes, or its oldest message has
+// been queued for flush_interval_us microseconds. Must be called before any
+// scripts are run.
+void worker_enable_send_queue(worker* w,
+                              int flush_size,
+                              int flush_bytes,
+                              int flush_interval_us) {
+  Locker locker(w->isolate);
+  w->send_queue = new SendQueue(w->id, flush_size, flush_bytes,
+                                std::chrono::microseconds(flush_interval_us));
+  w->isolate->AddCallCompletedCallback(FlushSendQueue);
+}
+
+void worker_get_module_stats(worker* w, worker_module_stats* stats) {
+  *stats = w->module_stats;
+}
+
+// Discards the worker's current context, along with its module map and any
+// registered callbacks, and replaces it with a pristine one on the same
+// isolate. This avoids the cost of tearing down and recreating the isolate.
+// The worker's channel, if any, is kept, along with any messages in its rings,
+// and exposed to the new context as $channel.
+//
+// If the worker has failed by reaching its heap limit, the discarded context is
+// collected, the heap limit that NearHeapLimit raised is restored, and the
+// worker is usable again. If tenant contexts still hold more than the limit,
+// V8 restores the smallest limit that the remaining heap allows instead.
+void worker_reset(worker* w) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  DisposeModuleData(Local<Context>::New(w->isolate, w->context));
+  DropPendingRequests(w, 0);
+  w->recv.Reset();
+  w->recv_sync_handler.Reset();
+  w->context.Reset();
+  w->last_exception.clear();
+  w->isolate->ContextDisposedNotification();
+
+  if (w->heap_limit_reached) {
+    w->isolate->LowMemoryNotification();
+    w->isolate->RemoveNearHeapLimitCallback(NearHeapLimit,
+                                            w->initial_heap_limit);
+    w->isolate->AddNearHeapLimitCallback(NearHeapLimit, w);
+    w->isolate->CancelTerminateExecution();
+    w->heap_limit_reached = false;
+  }
+
+  Local<Context> context = NewWorkerContext(w, NULL);
+  w->context.Reset(w->isolate, context);
+  if (w->channel != NULL) {
+    InstallChannel(w, context);
+  }
+}
+
+// Creates a tenant context with the given id, which must be positive and unique
+// within the worker. Tenants persist across worker_reset.
+worker_context* worker_context_create(worker* w, int id) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  worker_context* c = new (worker_context);
+  c->id = id;
+  c->w = w;
+  c->allocated = 0;
+  {
+    AllocationScope allocation_scope(c);
+    c->context.Reset(w->isolate, NewWorkerContext(w, c));
+  }
+  w->tenants[id] = c;
+  return c;
+}
+
+void worker_context_destroy(worker_context* c) {
+  worker* w = c->w;
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  w->tenants.erase(c->id);
+  DisposeTenant(c);
+}
+
+// Returns the approximate number of bytes allocated on the shared heap by code
+// running within the tenant, summed over all calls into it. It only ever grows,
+// so it measures how much work a tenant has done rather than how much memory it
+// currently holds.
+size_t worker_context_allocated(worker_context* c) {
+  return c->allocated;
+}
+
+int worker_context_load_script(worker_context* c,
+                               char* name_s,
+                               char* source_s) {
+  worker* w = c->w;
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+  AllocationScope allocation_scope(c);
+
+  Local<Context> context = Local<Context>::New(w->isolate, c->context);
+  return LoadScript(w, context, name_s, source_s, NULL);
+}
+
+int worker_context_run_script(worker_context* c, int script_id) {
+  worker* w = c->w;
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+  AllocationScope allocation_scope(c);
+
+  Local<Context> context = Local<Context>::New(w->isolate, c->context);
+  return RunScript(w, context, script_id);
+}
+
+// Calls the given $recv callback within the context. Must be called with the
+// isolate locked and entered.
+int CallRecv(worker* w,
+             Local<Context> context,
+             Persistent<Function>& handler,
+             Local<Value> msg) {
+  HandleScope handle_scope(w->isolate);
+  Context::Scope context_scope(context);
+
+  TryCatch try_catch(w->isolate);
+
+  Local<Function> recv = Local<Function>::New(w->isolate, handler);
+  if (recv.IsEmpty()) {
+    w->last_exception = "v8worker: callback not registered with $recv";
+    return 1;
+  }
+
+  Local<Value> args[1];
+  args[0] = msg;
+
+  assert(!try_catch.HasCaught());
+
+  recv->Call(context->Global(), 1, args);
+
+  if (try_catch.HasCaught()) {
+    w->last_exception = ExceptionString(w->isolate, context, &try_catch);
+    return 2;
+  }
+
+  return 0;
+}
+
+// Calls the given $recvSync callback within the context and writes its string
+// value into the worker's sync response buffer, which Go borrows until the next
+// call. Returns the length of the response. Must be called with the isolate
+// locked and entered.
+int CallRecvSync(worker* w,
+                 Local<Context> context,
+                 Persistent<Function>& handler,
+                 Local<Value> msg,
+                 const char** resp) {
+  std::string& out = w->sync_response;
+  HandleScope handle_scope(w->isolate);
+  Context::Scope context_scope(context);
+
+  Local<Function> recv_sync_handler = Local<Function>::New(w->isolate, handler);
+  if (recv_sync_handler.IsEmpty()) {
+    out.assign("v8worker: callback not registered with $recvSync");
+  } else {
+    Local<Value> args[1];
+    args[0] = msg;
+    Local<Value> response_value =
+        recv_sync_handler->Call(context->Global(), 1, args);
+    if (!response_value.IsEmpty() && response_value->IsString()) {
+      WriteUtf8(Local<String>::Cast(response_value), &out);
+    } else {
+      out.assign("v8worker: non-string return value");
+    }
+  }
+  *resp = out.data();
+  return out.size();
+}
+
+// Passes the outcome of a worker_send_async call to Go.
+void SettleAsyncCall(worker* w, int call, bool rejected, Local<Value> value) {
+  if (!rejected && !value->IsString()) {
+    std::string err = "v8worker: non-string return value";
+    asyncResultCb(w->id, call, 1, (char*)err.data(), err.size());
+    return;
+  }
+  String::Utf8Value str(w->isolate, value);
+  const char* data = ToCString(str);
+  int length = *str ? str.length() : strlen(data);
+  asyncResultCb(w->id, call, rejected, (char*)data, length);
+}
+
+// The reactions attached to a Promise returned by a $recvSync callback. The
+// id of the call is passed in as the function's data.
+void AsyncCallFulfilled(const FunctionCallbackInfo<Value>& args) {
+  worker* w = static_cast<worker*>(args.GetIsolate()->GetData(0));
+  SettleAsyncCall(w, Local<Integer>::Cast(args.Data())->Value(), false,
+                  args[0]);
+}
+
+void AsyncCallRejected(const FunctionCallbackInfo<Value>& args) {
+  worker* w = static_cast<worker*>(args.GetIsolate()->GetData(0));
+  SettleAsyncCall(w, Local<Integer>::Cast(args.Data())->Value(), true,
+                  args[0]);
+}
+
+// Calls the given $recvSync callback within the context and passes its
+// result to Go with asyncResultCb once it's known. If the callback returns a
+// Promise, the result is passed on whenever the Promise settles, e.g. in a
+// later call that resolves whatever it's waiting on. Must be called with the
+// isolate locked and entered.
+void CallRecvAsync(worker* w,
+                   Local<Context> context,
+                   Persistent<Function>& handler,
+                   int call,
+                   Local<Value> msg) {
+  HandleScope handle_scope(w->isolate);
+  Context::Scope context_scope(context);
+  TryCatch try_catch(w->isolate);
+
+  Local<Function> recv_sync_handler = Local<Function>::New(w->isolate, handler);
+  if (recv_sync_handler.IsEmpty()) {
+    SettleAsyncCall(
+        w, call, true,
+        String::NewFromUtf8(w->isolate,
+                            "v8worker: callback not registered with $recvSync"));
+    return;
+  }
+
+  Local<Value> args[1];
+  args[0] = msg;
+  Local<Value> result;
+  if (!recv_sync_handler->Call(context, context->Global(), 1, args)
+           .ToLocal(&result)) {
+    std::string err = ExceptionString(w->isolate, context, &try_catch);
+    asyncResultCb(w->id, call, 1, (char*)err.data(), err.size());
+    return;
+  }
+  if (!result->IsPromise()) {
+    SettleAsyncCall(w, call, false, result);
+    return;
+  }
+
+  Local<Promise> promise = Local<Promise>::Cast(result);
+  Local<Integer> data = Integer::New(w->isolate, call);
+  Local<Function> on_fulfilled, on_rejected;
+  if (!Function::New(context, AsyncCallFulfilled, data, 1)
+           .ToLocal(&on_fulfilled) ||
+      !Function::New(context, AsyncCallRejected, data, 1)
+           .ToLocal(&on_rejected) ||
+      promise->Then(context, on_fulfilled).IsEmpty() ||
+      promise->Catch(context, on_rejected).IsEmpty()) {
+    std::string err = ExceptionString(w->isolate, context, &try_catch);
+    asyncResultCb(w->id, call, 1, (char*)err.data(), err.size());
+    return;
+  }
+  // The handler's own call has already drained the microtask queue, so the
+  // reactions to an already settled Promise need running explicitly.
+  w->isolate->RunMicrotasks();
+}
+
+// Makes the calling thread the permanent owner of the worker's isolate. It
+// keeps the isolate locked and entered until worker_disown, so the Lockers and
+// Isolate::Scopes of its later calls are no-ops. Calls from any other thread
+// will block until then.
+void worker_own(worker* w) {
+  assert(w->owner == NULL);
+  w->owner = new Locker(w->isolate);
+  w->isolate->Enter();
+  // The owner thread is the only one to run the worker's JavaScript, so its
+  // stack limit can be set once and for all.
+  if (w->max_stack_bytes != 0) {
+    char here;
+    w->isolate->SetStackLimit(reinterpret_cast<uintptr_t>(&here) -
+                              w->max_stack_bytes);
+  }
+}
+
+// Releases the isolate held by the owner thread. Must be called from it.
+void worker_disown(worker* w) {
+  assert(w->owner != NULL && Locker::IsLocked(w->isolate));
+  w->isolate->Exit();
+  delete w->owner;
+  w->owner = NULL;
+}
+
+// Returns whether the isolate is locked by the calling thread, i.e. whether
+// it is the owner thread, or is in a callback from the isolate.
+int worker_locked_by_caller(worker* w) {
+  return Locker::IsLocked(w->isolate);
+}
+
+// Hints that the worker is idle and should free as much memory as it can.
+void worker_low_memory_notification(worker* w) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  w->isolate->LowMemoryNotification();
+}
+
+// Called from Go to send messages to JavaScript. It will call the callback
+// registered with $recv. The message is only borrowed for the duration of the
+// call. A non-zero return value indicates error. Check worker_last_exception().
+int worker_send(worker* w, const char* msg, int length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<String> str;
+  if (!NewMessageString(w->isolate, msg, length).ToLocal(&str)) {
+    w->last_exception = "v8worker: message too long";
+    return 1;
+  }
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  return CallRecv(w, context, w->recv, str);
+}
+
+// Called from Go to send messages to JavaScript. It will call the callback
+// registered with $recvSync, point resp at its string value, and return the
+// value's length. The message is only borrowed for the duration of the call,
+// and the response is only valid until the next call into the worker.
+int worker_send_sync(worker* w,
+                     const char* msg,
+                     int length,
+                     const char** resp) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<String> str;
+  if (!NewMessageString(w->isolate, msg, length).ToLocal(&str)) {
+    w->sync_response.assign("v8worker: message too long");
+    *resp = w->sync_response.data();
+    return w->sync_response.size();
+  }
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  return CallRecvSync(w, context, w->recv_sync_handler, str, resp);
+}
+
+// Called from Go to send messages to JavaScript. It will call the callback
+// registered with $recvSync and pass its result to Go under the given call id
+// via asyncResultCb, which may happen after this returns if the callback
+// returns a Promise. The message is only borrowed for the duration of the call.
+void worker_send_async(worker* w, int call, const char* msg, int length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<String> str;
+  if (!NewMessageString(w->isolate, msg, length).ToLocal(&str)) {
+    std::string err = "v8worker: message too long";
+    asyncResultCb(w->id, call, 1, (char*)err.data(), err.size());
+    return;
+  }
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  CallRecvAsync(w, context, w->recv_sync_handler, call, str);
+}
+
+// Calls the callback registered with $recv once for each of the given messages
+// within a single entry into the isolate. The callback registered at the start
+// of the batch is used for all of the messages. Each element of errors is set
+// to a malloc'd description of the exception raised by the corresponding call,
+// or NULL if it succeeded. Returns the number of messages that failed.
+int worker_send_batch(worker* w,
+                      int count,
+                      const char* msgs,
+                      const int* lengths,
+                      const char** errors) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+  Local<Function> recv = Local<Function>::New(w->isolate, w->recv);
+  Local<Object> global = context->Global();
+  TryCatch try_catch(w->isolate);
+
+  int failed = 0;
+  const char* msg = msgs;
+  for (int i = 0; i < count; msg += lengths[i++]) {
+    if (recv.IsEmpty()) {
+      errors[i] = CopyString("v8worker: callback not registered with $recv");
+      failed++;
+      continue;
+    }
+    HandleScope message_scope(w->isolate);
+    Local<Value> args[1];
+    if (!NewMessageString(w->isolate, msg, lengths[i]).ToLocal(&args[0])) {
+      errors[i] = CopyString("v8worker: message too long");
+      failed++;
+      continue;
+    }
+    if (recv->Call(context, global, 1, args).IsEmpty()) {
+      errors[i] = CopyString(ExceptionString(w->isolate, context, &try_catch));
+      try_catch.Reset();
+      failed++;
+    } else {
+      errors[i] = NULL;
+    }
+  }
+  return failed;
+}
+
+// Calls the callback registered with $recvSync once for each of the given
+// messages within a single entry into the isolate, and sets each element of
+// responses to a malloc'd copy of the corresponding string return value, with
+// its length in response_lengths. If a call raises an exception or doesn't
+// return a string, its response is NULL and the corresponding element of
+// errors is set to a malloc'd description of the failure. Returns the number
+// of messages that failed.
+int worker_send_sync_batch(worker* w,
+                           int count,
+                           const char* msgs,
+                           const int* lengths,
+                           const char** responses,
+                           int* response_lengths,
+                           const char** errors) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+  Local<Function> handler =
+      Local<Function>::New(w->isolate, w->recv_sync_handler);
+  Local<Object> global = context->Global();
+  TryCatch try_catch(w->isolate);
+
+  int failed = 0;
+  const char* msg = msgs;
+  for (int i = 0; i < count; msg += lengths[i++]) {
+    responses[i] = NULL;
+    response_lengths[i] = 0;
+    errors[i] = NULL;
+    if (handler.IsEmpty()) {
+      errors[i] =
+          CopyString("v8worker: callback not registered with $recvSync");
+      failed++;
+      continue;
+    }
+    HandleScope message_scope(w->isolate);
+    Local<Value> args[1];
+    if (!NewMessageString(w->isolate, msg, lengths[i]).ToLocal(&args[0])) {
+      errors[i] = CopyString("v8worker: message too long");
+      failed++;
+      continue;
+    }
+    Local<Value> response;
+    if (!handler->Call(context, global, 1, args).ToLocal(&response)) {
+      errors[i] = CopyString(ExceptionString(w->isolate, context, &try_catch));
+      try_catch.Reset();
+      failed++;
+    } else if (!response->IsString()) {
+      errors[i] = CopyString("v8worker: non-string return value");
+      failed++;
+    } else {
+      std::string& out = w->sync_response;
+      WriteUtf8(Local<String>::Cast(response), &out);
+      char* copy = (char*)malloc(out.size() + 1);
+      memcpy(copy, out.data(), out.size());
+      responses[i] = copy;
+      response_lengths[i] = out.size();
+    }
+  }
+  return failed;
+}
+
+// Allocates a buffer that can be passed to worker_send_buffer. It must be freed
+// with worker_buffer_free unless its ownership is passed to a worker.
+void* worker_buffer_alloc(size_t length) {
+  size_t capacity;
+  return array_buffers.Acquire(length, &capacity);
+}
+
+// Frees a buffer allocated with worker_buffer_alloc or received from
+// $sendBuffer. The length must be the full length of the allocation.
+void worker_buffer_free(void* data, size_t length) {
+  array_buffers.Release(static_cast<char*>(data), length);
+}
+
+// Returns the number of bytes taken up by the worker's ArrayBuffers.
+size_t worker_array_buffer_bytes(worker* w) {
+  return w->allocator->allocated();
+}
+
+// Passes a buffer allocated with worker_buffer_alloc to the callback registered
+// with $recv as an ArrayBuffer, without copying. Ownership of the buffer moves
+// to the worker, even if an error is returned, and it's freed when the
+// ArrayBuffer is garbage collected.
+int worker_send_buffer(worker* w, void* data, size_t length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(
+      w->isolate, data, length, ArrayBufferCreationMode::kInternalized);
+  w->allocator->Adopt(length);
+  return CallRecv(w, context, w->recv, buffer);
+}
+
+// Deserializes a value in V8's structured serialization format and passes it
+// to the callback registered with $recv. The data is only borrowed for the
+// duration of the call.
+int worker_send_value(worker* w, const char* data, int length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+  TryCatch try_catch(w->isolate);
+
+  ValueDeserializer deserializer(
+      w->isolate, reinterpret_cast<const uint8_t*>(data), length);
+  Local<Value> value;
+  if (!deserializer.ReadHeader(context).FromMaybe(false) ||
+      !deserializer.ReadValue(context).ToLocal(&value)) {
+    w->last_exception = ExceptionString(w->isolate, context, &try_catch);
+    return 1;
+  }
+  return CallRecv(w, context, w->recv, value);
+}
+
+// Parses the given UTF-8 encoded JSON natively and passes the resulting value
+// to the callback registered with $recv. The message is only borrowed for the
+// duration of the call. Returns 3 if the message isn't valid JSON, with
+// worker_last_exception() describing the SyntaxError, and otherwise the same
+// values as worker_send.
+int worker_send_json(worker* w, const char* msg, int length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  Local<Context> context = Local<Context>::New(w->isolate, w->context);
+  Context::Scope context_scope(context);
+  TryCatch try_catch(w->isolate);
+
+  Local<String> str;
+  if (!NewMessageString(w->isolate, msg, length).ToLocal(&str)) {
+    w->last_exception = "v8worker: message too long";
+    return 1;
+  }
+  Local<Value> value;
+  if (!JSON::Parse(context, str).ToLocal(&value)) {
+    String::Utf8Value exception(w->isolate, try_catch.Exception());
+    w->last_exception = ToCString(exception);
+    return 3;
+  }
+  return CallRecv(w, context, w->recv, value);
+}
+
+// Opens a channel with rings of the given capacity, which must be a power of
+// two, and exposes it to the worker's default context as $channel. Script only
+// gets the read and write functions, not the rings themselves, so it can't
+// tamper with their headers or frames. A worker has at most one channel, which
+// lasts until the worker is disposed, and is exposed again after a reset.
+worker_channel* worker_channel_open(worker* w, int capacity) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  if (w->channel != NULL) {
+    return NULL;
+  }
+  worker_channel* c = new (worker_channel);
+  c->w = w;
+  c->capacity = capacity;
+  c->closed = false;
+  size_t size = sizeof(RingHeader) + capacity;
+  c->inbound = static_cast<char*>(calloc(1, size));
+  c->outbound = static_cast<char*>(calloc(1, size));
+  w->channel = c;
+
+  InstallChannel(w, Local<Context>::New(w->isolate, w->context));
+  return c;
+}
+
+// Returns the memory of the inbound ring if outbound is zero, or of the
+// outbound ring otherwise.
+void* worker_channel_ring(worker_channel* c, int outbound) {
+  return outbound ? c->outbound : c->inbound;
+}
+
+// Wakes JavaScript if it's waiting on the channel. Go only calls this when the
+// rings show that JavaScript is waiting.
+void worker_channel_wake(worker_channel* c) {
+  std::lock_guard<std::mutex> lock(c->mutex);
+  c->cond.notify_all();
+}
+
+// Closes the channel. Pending and future reads in JavaScript return null once
+// the inbound ring has been drained, and writes raise exceptions.
+void worker_channel_close(worker_channel* c) {
+  std::lock_guard<std::mutex> lock(c->mutex);
+  c->closed = true;
+  c->cond.notify_all();
+}
+
+// Settles the Promise for a pending $sendAsync request and runs the resulting
+// microtasks. Returns non-zero if there's no such request, e.g. because it has
+// already been settled or its context has since been reset.
+int SettleRequest(worker* w,
+                  int id,
+                  bool reject,
+                  const char* data,
+                  int length) {
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+
+  auto it = w->pending_requests.find(id);
+  if (it == w->pending_requests.end()) {
+    return 1;
+  }
+  Local<Promise::Resolver> resolver =
+      Local<Promise::Resolver>::New(w->isolate, it->second.resolver);
+  w->pending_requests.erase(it);
+
+  Local<Context> context = resolver->CreationContext();
+  Context::Scope context_scope(context);
+  Local<String> value;
+  if (!NewMessageString(w->isolate, data, length).ToLocal(&value)) {
+    value = String::NewFromUtf8(w->isolate, "v8worker: message too long");
+    reject = true;
+  }
+  if (reject) {
+    resolver->Reject(context, Exception::Error(value)).FromJust();
+  } else {
+    resolver->Resolve(context, value).FromJust();
+  }
+  w->isolate->RunMicrotasks();
+  return 0;
+}
+
+// Resolves the Promise returned by $sendAsync for the given request id with
+// the payload. It may be called from any thread.
+int worker_resolve(worker* w, int id, const char* payload, int length) {
+  return SettleRequest(w, id, false, payload, length);
+}
+
+// Rejects the Promise returned by $sendAsync for the given request id with an
+// Error carrying the given message. It may be called from any thread.
+int worker_reject(worker* w, int id, const char* error, int length) {
+  return SettleRequest(w, id, true, error, length);
+}
+
+// Like worker_send, but calls the $recv callback of the given tenant.
+int worker_send_ctx(worker_context* c, const char* msg, int length) {
+  worker* w = c->w;
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+  AllocationScope allocation_scope(c);
+
+  Local<String> str;
+  if (!NewMessageString(w->isolate, msg, length).ToLocal(&str)) {
+    w->last_exception = "v8worker: message too long";
+    return 1;
+  }
+  Local<Context> context = Local<Context>::New(w->isolate, c->context);
+  return CallRecv(w, context, c->recv, str);
+}
+
+// Like worker_send_sync, but calls the $recvSync callback of the given tenant.
+int worker_send_sync_ctx(worker_context* c,
+                         const char* msg,
+                         int length,
+                         const char** resp) {
+  worker* w = c->w;
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+  AllocationScope allocation_scope(c);
+
+  Local<String> str;
+  if (!NewMessageString(w->isolate, msg, length).ToLocal(&str)) {
+    w->sync_response.assign("v8worker: message too long");
+    *resp = w->sync_response.data();
+    return w->sync_response.size();
+  }
+  Local<Context> context = Local<Context>::New(w->isolate, c->context);
+  return CallRecvSync(w, context, c->recv_sync_handler, str, resp);
+}
+
+// Like worker_send_async, but calls the $recvSync callback of the given tenant.
+void worker_send_async_ctx(worker_context* c,
+                           int call,
+                           const char* msg,
+                           int length) {
+  worker* w = c->w;
+  Locker locker(w->isolate);
+  Isolate::Scope isolate_scope(w->isolate);
+  HandleScope handle_scope(w->isolate);
+  AllocationScope allocation_scope(c);
+
+  Local<String> str;
+  if (!NewMessageString(w->isolate, msg, length).ToLocal(&str)) {
+    std::string err = "v8worker: message too long";
+    asyncResultCb(w->id, call, 1, (char*)err.data(), err.size());
+    return;
+  }
+  Local<Context> context = Local<Context>::New(w->isolate, c->context);
+  CallRecvAsync(w, context, c->recv_sync_handler, call, str);
+}
+
+// Removes the given module from the process-wide source store, so that it's
+// fetched from Go again the next time it's loaded.
+void worker_invalidate_module_source(const char* url_s) {
+  module_sources.Invalidate(url_s);
+}
+
+void worker_clear_module_sources() {
+  module_sources.Clear();
 }
 
 void worker_terminate_execution(worker* w) {
@@ -1,3 +1,8 @@
+#ifndef V8WORKER_BINDING_H
+#define V8WORKER_BINDING_H
+
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -5,19 +10,147 @@ extern "C" {
 struct worker_s;
 typedef struct worker_s worker;
 
+struct worker_context_s;
+typedef struct worker_context_s worker_context;
+
+struct worker_channel_s;
+typedef struct worker_channel_s worker_channel;
+
+struct worker_script_stream_s;
+typedef struct worker_script_stream_s worker_script_stream;
+
+typedef struct worker_code_cache_stats_s {
+  unsigned long long memory_hits;
+  unsigned long long disk_hits;
+  unsigned long long misses;
+  unsigned long long rejects;
+} worker_code_cache_stats;
+
+typedef struct worker_module_stats_s {
+  unsigned long long fetched;
+  unsigned long long compiled;
+  unsigned long long reused;
+} worker_module_stats;
+
+typedef struct worker_limits_s {
+  size_t max_old_generation_bytes;
+  size_t max_young_generation_bytes;
+  size_t max_stack_bytes;  // Only applied to owned workers.
+  size_t max_array_buffer_bytes;
+} worker_limits;
+
+typedef struct worker_snapshot_s {
+  const char* data;
+  int size;
+} worker_snapshot;
+
 void v8_init();
 
+int worker_create_snapshot(char* name_s,
+                           char* source_s,
+                           int enable_print,
+                           worker_snapshot* snapshot,
+                           const char** err);
+void worker_snapshot_dispose(worker_snapshot* snapshot);
+
 void worker_dispose(worker* w);
 
-worker* worker_init(int id, int enable_print);
+worker* worker_init(int id,
+                    int enable_print,
+                    int resolve_module_urls,
+                    int batch_module_fetch,
+                    worker_snapshot* snapshot,
+                    const worker_limits* limits);
+int worker_heap_limit_reached(worker* w);
+void worker_reset(worker* w);
+void worker_own(worker* w);
+void worker_disown(worker* w);
+int worker_locked_by_caller(worker* w);
+void worker_low_memory_notification(worker* w);
+void worker_enable_send_queue(worker* w,
+                              int flush_size,
+                              int flush_bytes,
+                              int flush_interval_us);
 
 const char* worker_last_exception(worker* w);
 
-int worker_load_module(worker* w, char* url_s);
+int worker_load_module(worker* w, char* url_s, int batch);
+int worker_prefetch_module(worker* w, char* url_s);
+void worker_get_module_stats(worker* w, worker_module_stats* stats);
+void worker_invalidate_module_source(const char* url_s);
+void worker_clear_module_sources();
 int worker_load_script(worker* w, char* name_s, char* source_s);
+int worker_load_script_cached(worker* w,
+                              char* name_s,
+                              char* source_s,
+                              char* key_s);
 
-int worker_send(worker* w, const char* msg);
-const char* worker_send_sync(worker* w, const char* msg);
+int worker_load_scripts(worker* w,
+                        int count,
+                        char** names,
+                        char** sources,
+                        int* failed);
+
+worker_script_stream* worker_load_script_stream(worker* w, char* name_s);
+void worker_script_stream_write(worker_script_stream* s,
+                                const char* data,
+                                int length);
+int worker_script_stream_finish(worker_script_stream* s, int abort);
+
+void worker_code_cache_configure(size_t capacity);
+void worker_code_cache_get_stats(worker_code_cache_stats* stats);
+
+int worker_compile_script(worker* w, char* name_s, char* source_s);
+int worker_run_script(worker* w, int script_id);
+
+int worker_send(worker* w, const char* msg, int length);
+int worker_send_sync(worker* w,
+                     const char* msg,
+                     int length,
+                     const char** resp);
+void worker_send_async(worker* w, int call, const char* msg, int length);
+int worker_send_batch(worker* w,
+                      int count,
+                      const char* msgs,
+                      const int* lengths,
+                      const char** errors);
+int worker_send_sync_batch(worker* w,
+                           int count,
+                           const char* msgs,
+                           const int* lengths,
+                           const char** responses,
+                           int* response_lengths,
+                           const char** errors);
+
+void* worker_buffer_alloc(size_t length);
+void worker_buffer_free(void* data, size_t length);
+size_t worker_array_buffer_bytes(worker* w);
+int worker_send_buffer(worker* w, void* data, size_t length);
+int worker_send_value(worker* w, const char* data, int length);
+int worker_send_json(worker* w, const char* msg, int length);
+
+int worker_resolve(worker* w, int id, const char* payload, int length);
+int worker_reject(worker* w, int id, const char* error, int length);
+
+worker_channel* worker_channel_open(worker* w, int capacity);
+void* worker_channel_ring(worker_channel* c, int outbound);
+void worker_channel_wake(worker_channel* c);
+void worker_channel_close(worker_channel* c);
+
+worker_context* worker_context_create(worker* w, int id);
+void worker_context_destroy(worker_context* c);
+size_t worker_context_allocated(worker_context* c);
+int worker_context_load_script(worker_context* c, char* name_s, char* source_s);
+int worker_context_run_script(worker_context* c, int script_id);
+int worker_send_ctx(worker_context* c, const char* msg, int length);
+int worker_send_sync_ctx(worker_context* c,
+                         const char* msg,
+                         int length,
+                         const char** resp);
+void worker_send_async_ctx(worker_context* c,
+                           int call,
+                           const char* msg,
+                           int length);
 
 void worker_terminate_execution(worker* w);
 
@@ -26,3 +159,5 @@ const char* worker_version();
 #ifdef __cplusplus
 }  // extern "C"
 #endif
+
+#endif  // V8WORKER_BINDING_H
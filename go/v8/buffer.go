@@ -0,0 +1,109 @@
+package v8
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"errors"
+	"unsafe"
+)
+
+var errBufferReleased = errors.New("v8: Buffer has already been freed or sent")
+
+// Buffer is a block of native memory that can be passed between Go and
+// JavaScript without being copied.
+//
+// A Buffer has a single owner at any time. Buffers created with NewBuffer are
+// owned by the caller until they are passed to Worker.SendBuffer, at which
+// point ownership moves to the JavaScript VM and the Buffer can no longer be
+// used. Buffers passed to HandleSendBuffer are owned by the handler. Owners
+// must call Free once they are done with a Buffer, as its memory isn't managed
+// by the Go garbage collector.
+type Buffer struct {
+	data   unsafe.Pointer
+	length int
+	offset int
+	size   int
+}
+
+// NewBuffer allocates a Buffer of the given size. Its contents are
+// uninitialised.
+func NewBuffer(size int) *Buffer {
+	initV8()
+	return &Buffer{
+		data:   C.worker_buffer_alloc(C.size_t(size)),
+		length: size,
+		size:   size,
+	}
+}
+
+// Bytes returns a slice backed by the Buffer's memory. For Buffers received
+// from a typed array or DataView, it only covers the bytes within the view. The
+// slice must not be used once the Buffer has been freed or sent.
+func (b *Buffer) Bytes() []byte {
+	if b.data == nil || b.length == 0 {
+		return nil
+	}
+	end := b.offset + b.length
+	return (*[1 << 30]byte)(b.data)[b.offset:end:end]
+}
+
+// Free releases the Buffer's memory. It's safe to call Free more than once.
+func (b *Buffer) Free() {
+	if b.data == nil {
+		return
+	}
+	C.worker_buffer_free(b.data, C.size_t(b.size))
+	b.data = nil
+}
+
+// Len returns the number of bytes in the Buffer.
+func (b *Buffer) Len() int {
+	return b.length
+}
+
+//export recvBufferCb
+func recvBufferCb(id int32, data unsafe.Pointer, size C.size_t, offset C.size_t, length C.size_t) {
+	b := &Buffer{
+		data:   data,
+		length: int(length),
+		offset: int(offset),
+		size:   int(size),
+	}
+	cb := getInstance(id).handleSendBuffer
+	if cb == nil {
+		b.Free()
+		return
+	}
+	cb(b)
+}
+
+// SendBuffer passes the Buffer to the $recv callback in JavaScript as an
+// ArrayBuffer, without copying its contents. Ownership of the Buffer moves to
+// the JavaScript VM, even if an error is returned, and the Buffer must not be
+// used afterwards. Only the bytes covered by Bytes are visible to JavaScript.
+func (w *Worker) SendBuffer(b *Buffer) (err error) {
+	if b.data == nil {
+		return errBufferReleased
+	}
+	data, size := b.data, b.size
+	if b.offset != 0 || b.length != b.size {
+		// V8 frees the memory it's given with the length it sees, so views
+		// are copied into an exactly-sized buffer.
+		data = C.worker_buffer_alloc(C.size_t(b.length))
+		size = b.length
+		copy((*[1 << 30]byte)(data)[:size:size], b.Bytes())
+		b.Free()
+	}
+	b.data = nil
+
+	w.runLocked(func() {
+		if C.worker_send_buffer(w.instance.worker, data, C.size_t(size)) != 0 {
+			err = w.getError()
+		}
+	})
+	return err
+}
@@ -0,0 +1,259 @@
+package v8
+
+/*
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"errors"
+	"sync"
+	"sync/atomic"
+	"unsafe"
+)
+
+var (
+	errChannelClosed  = errors.New("v8: Channel has been closed")
+	errChannelCorrupt = errors.New("v8: Channel ring holds an invalid frame")
+	errChannelOpen    = errors.New("v8: Worker already has a Channel")
+	errChannelSize    = errors.New("v8: Channel capacity must be a power of two of at least 64 bytes")
+	errMessageTooLong = errors.New("v8: message too long for Channel")
+)
+
+// The offsets of the fields within a ring's header, as laid out by RingHeader
+// in binding.cc.
+const (
+	ringHead            = 0
+	ringProducerWaiting = 4
+	ringTail            = 64
+	ringConsumerWaiting = 68
+	ringHeaderSize      = 128
+)
+
+// Channel is a pair of shared-memory ring buffers for exchanging messages with
+// a Worker's JavaScript at high rates. Go and the native $channel functions
+// read and write the rings directly, so neither side has to enter the other's
+// runtime while messages are flowing. The only calls across the boundary are to
+// wake a side that's blocked waiting on an empty or full ring. Script never
+// sees the rings themselves, and neither side trusts the frame lengths it
+// reads: an invalid frame closes the Channel.
+//
+// Within JavaScript, the channel is exposed as $channel, with read and write
+// functions. $channel.read blocks until a message arrives, for up to an
+// optional timeout in milliseconds, and returns null on timeout or once the
+// Channel has been closed and drained. $channel.write blocks while the
+// outbound ring is full. As the JavaScript side blocks the Worker's thread, it
+// is expected to run in a dedicated loop, e.g. via LoadScript on its own
+// goroutine.
+type Channel struct {
+	capacity   uint32
+	channel    *C.worker_channel
+	closed     chan struct{}
+	closeOnce  sync.Once
+	inbound    unsafe.Pointer
+	outbound   unsafe.Pointer
+	readMutex  sync.Mutex
+	readable   chan struct{}
+	worker     *Worker
+	writable   chan struct{}
+	writeMutex sync.Mutex
+}
+
+// OpenChannel creates the Worker's Channel, with rings of the given capacity in
+// bytes, and exposes it to JavaScript as $channel in the Worker's default
+// context. The capacity must be a power of two. A Worker can only have a single
+// Channel. It survives a Reset, along with any messages that haven't been read,
+// and $channel is reinstalled in the new global scope.
+func (w *Worker) OpenChannel(capacity int) (*Channel, error) {
+	if capacity < 64 || capacity > 1<<30 || capacity&(capacity-1) != 0 {
+		return nil, errChannelSize
+	}
+
+	var ch *C.worker_channel
+	w.runLocked(func() {
+		ch = C.worker_channel_open(w.instance.worker, C.int(capacity))
+	})
+	if ch == nil {
+		return nil, errChannelOpen
+	}
+	c := &Channel{
+		capacity: uint32(capacity),
+		channel:  ch,
+		closed:   make(chan struct{}),
+		inbound:  C.worker_channel_ring(ch, 0),
+		outbound: C.worker_channel_ring(ch, 1),
+		readable: make(chan struct{}, 1),
+		worker:   w,
+		writable: make(chan struct{}, 1),
+	}
+	// The registry only holds on to the wake channels, so that it doesn't keep
+	// the Worker from being garbage collected.
+	closed, once := c.closed, &c.closeOnce
+	mutex.Lock()
+	w.instance.channelReadable = c.readable
+	w.instance.channelWritable = c.writable
+	w.instance.channelPoisoned = func() {
+		once.Do(func() { close(closed) })
+	}
+	mutex.Unlock()
+	return c, nil
+}
+
+// Close closes the Channel. Reads in JavaScript return null once the messages
+// already written have been read, and further writes on either side fail.
+func (c *Channel) Close() {
+	c.closeOnce.Do(func() {
+		close(c.closed)
+		C.worker_channel_close(c.channel)
+	})
+}
+
+// Read returns the next message written by JavaScript, blocking until one is
+// available. It returns an error once the Channel has been closed, and closes
+// it if the outbound ring holds an invalid frame.
+func (c *Channel) Read() ([]byte, error) {
+	c.readMutex.Lock()
+	defer c.readMutex.Unlock()
+
+	ring := c.outbound
+	data := ringData(ring, c.capacity)
+	tail := atomic.LoadUint32(ringField(ring, ringTail))
+	for atomic.LoadUint32(ringField(ring, ringHead)) == tail {
+		if err := c.wait(ring, ringConsumerWaiting, c.readable, func() bool {
+			return atomic.LoadUint32(ringField(ring, ringHead)) != tail
+		}); err != nil {
+			return nil, err
+		}
+	}
+
+	available := atomic.LoadUint32(ringField(ring, ringHead)) - tail
+	var length [4]byte
+	if available >= 4 && available <= c.capacity {
+		ringCopyOut(data, tail, length[:])
+	}
+	n := *(*uint32)(unsafe.Pointer(&length[0]))
+	if available < 4 || available > c.capacity || n > c.capacity-4 || ringFrameSize(n) > available {
+		c.Close()
+		return nil, errChannelCorrupt
+	}
+	msg := make([]byte, n)
+	ringCopyOut(data, tail+4, msg)
+	atomic.StoreUint32(ringField(ring, ringTail), tail+ringFrameSize(uint32(len(msg))))
+	if atomic.LoadUint32(ringField(ring, ringProducerWaiting)) != 0 {
+		C.worker_channel_wake(c.channel)
+	}
+	return msg, nil
+}
+
+// Write writes a message for JavaScript to read, blocking while the inbound
+// ring is full.
+func (c *Channel) Write(msg []byte) error {
+	frame := ringFrameSize(uint32(len(msg)))
+	if uint64(len(msg)) >= uint64(c.capacity) || frame > c.capacity {
+		return errMessageTooLong
+	}
+
+	c.writeMutex.Lock()
+	defer c.writeMutex.Unlock()
+
+	ring := c.inbound
+	data := ringData(ring, c.capacity)
+	head := atomic.LoadUint32(ringField(ring, ringHead))
+	fits := func() bool {
+		return c.capacity-(head-atomic.LoadUint32(ringField(ring, ringTail))) >= frame
+	}
+	for !fits() {
+		if err := c.wait(ring, ringProducerWaiting, c.writable, fits); err != nil {
+			return err
+		}
+	}
+	select {
+	case <-c.closed:
+		return errChannelClosed
+	default:
+	}
+
+	length := uint32(len(msg))
+	ringCopyIn(data, head, (*[4]byte)(unsafe.Pointer(&length))[:])
+	ringCopyIn(data, head+4, msg)
+	atomic.StoreUint32(ringField(ring, ringHead), head+frame)
+	if atomic.LoadUint32(ringField(ring, ringConsumerWaiting)) != 0 {
+		C.worker_channel_wake(c.channel)
+	}
+	return nil
+}
+
+// Flag that Go is waiting on the given ring, and block until woken by
+// JavaScript, unless the condition became true in the meantime.
+func (c *Channel) wait(ring unsafe.Pointer, field uintptr, wake chan struct{}, ready func() bool) error {
+	waiting := ringField(ring, field)
+	atomic.StoreUint32(waiting, 1)
+	defer atomic.StoreUint32(waiting, 0)
+	if ready() {
+		return nil
+	}
+	select {
+	case <-wake:
+		return nil
+	case <-c.closed:
+		return errChannelClosed
+	}
+}
+
+// Wake the Go side of a Channel: writers if event is 0, readers if it's 1, or
+// both by closing the Channel if it's 2, as JavaScript found an invalid frame.
+//
+//export channelWakeCb
+func channelWakeCb(id int32, event C.int) {
+	mutex.Lock()
+	i := registry[id]
+	if i == nil {
+		mutex.Unlock()
+		return
+	}
+	wake := i.channelWritable
+	if event == 1 {
+		wake = i.channelReadable
+	}
+	poisoned := i.channelPoisoned
+	mutex.Unlock()
+	if event == 2 {
+		if poisoned != nil {
+			poisoned()
+		}
+		return
+	}
+	select {
+	case wake <- struct{}{}:
+	default:
+	}
+}
+
+// Copy data into the ring's data region starting at the given position,
+// wrapping around its end as needed.
+func ringCopyIn(data []byte, pos uint32, src []byte) {
+	offset := pos & uint32(len(data)-1)
+	n := copy(data[offset:], src)
+	copy(data, src[n:])
+}
+
+func ringCopyOut(data []byte, pos uint32, dst []byte) {
+	offset := pos & uint32(len(data)-1)
+	n := copy(dst, data[offset:])
+	copy(dst[n:], data)
+}
+
+// Return the data region of a ring.
+func ringData(ring unsafe.Pointer, capacity uint32) []byte {
+	return (*[1 << 30]byte)(unsafe.Pointer(uintptr(ring) + ringHeaderSize))[:capacity:capacity]
+}
+
+// Return a pointer to one of the fields in a ring's header.
+func ringField(ring unsafe.Pointer, offset uintptr) *uint32 {
+	return (*uint32)(unsafe.Pointer(uintptr(ring) + offset))
+}
+
+// Return the size of the frame holding a message of the given length.
+func ringFrameSize(length uint32) uint32 {
+	return 4 + (length+3)&^3
+}
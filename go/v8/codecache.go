@@ -0,0 +1,125 @@
+package v8
+
+/*
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"sync"
+
+	"github.com/espians/source/go/combihash"
+)
+
+var codeCache struct {
+	dir     string
+	enabled bool
+	mutex   sync.RWMutex
+}
+
+// CodeCacheStats provides a snapshot of the code cache's counters.
+type CodeCacheStats struct {
+	// MemoryHits and DiskHits count the scripts whose compiled code was found
+	// in the in-process and the on-disk caches respectively.
+	MemoryHits uint64
+	DiskHits   uint64
+
+	// Misses counts the scripts that had to be compiled from source.
+	Misses uint64
+
+	// Rejects counts the cached entries that V8 refused to use, e.g. because
+	// they were created by a different version of V8. These are regenerated.
+	Rejects uint64
+}
+
+// EnableCodeCache turns on the caching of compiled code for scripts loaded with
+// LoadScript. The compiled code is kept in a process-wide LRU cache of up to
+// maxMemory bytes, which is shared by all Workers. If dir is not empty, it is
+// also persisted to files within dir so that it survives restarts.
+//
+// ES Modules are not cached as V8 6.6 doesn't support code caches for them.
+func EnableCodeCache(dir string, maxMemory int) error {
+	if dir != "" {
+		if err := os.MkdirAll(dir, 0755); err != nil {
+			return err
+		}
+	}
+	C.worker_code_cache_configure(C.size_t(maxMemory))
+	codeCache.mutex.Lock()
+	codeCache.dir = dir
+	codeCache.enabled = true
+	codeCache.mutex.Unlock()
+	return nil
+}
+
+// GetCodeCacheStats returns the current counters for the code cache.
+func GetCodeCacheStats() CodeCacheStats {
+	var stats C.worker_code_cache_stats
+	C.worker_code_cache_get_stats(&stats)
+	return CodeCacheStats{
+		MemoryHits: uint64(stats.memory_hits),
+		DiskHits:   uint64(stats.disk_hits),
+		Misses:     uint64(stats.misses),
+		Rejects:    uint64(stats.rejects),
+	}
+}
+
+// Return the code cache key for the given source, or an empty string if the
+// code cache isn't enabled. The V8 version is included so that upgrades don't
+// result in a wave of rejected entries.
+func codeCacheKey(source string) string {
+	codeCache.mutex.RLock()
+	enabled := codeCache.enabled
+	codeCache.mutex.RUnlock()
+	if !enabled {
+		return ""
+	}
+	h := combihash.New()
+	h.Write([]byte(Version()))
+	h.Write([]byte{0})
+	h.Write([]byte(source))
+	return string(h.Base64())
+}
+
+// Read an entry from the on-disk code cache, returning nil if it's missing.
+func readCodeCacheFile(key string) []byte {
+	codeCache.mutex.RLock()
+	dir := codeCache.dir
+	codeCache.mutex.RUnlock()
+	if dir == "" {
+		return nil
+	}
+	data, err := ioutil.ReadFile(filepath.Join(dir, key))
+	if err != nil || len(data) == 0 {
+		return nil
+	}
+	return data
+}
+
+// Write an entry to the on-disk code cache. Failures are ignored as the entry
+// will simply be regenerated.
+func writeCodeCacheFile(key string, data []byte) {
+	codeCache.mutex.RLock()
+	dir := codeCache.dir
+	codeCache.mutex.RUnlock()
+	if dir == "" {
+		return
+	}
+	f, err := ioutil.TempFile(dir, ".tmp-")
+	if err != nil {
+		return
+	}
+	_, err = f.Write(data)
+	if cerr := f.Close(); err == nil {
+		err = cerr
+	}
+	if err == nil {
+		err = os.Rename(f.Name(), filepath.Join(dir, key))
+	}
+	if err != nil {
+		os.Remove(f.Name())
+	}
+}
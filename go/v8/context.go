@@ -0,0 +1,180 @@
+package v8
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"errors"
+	"runtime"
+	"unsafe"
+)
+
+var errContextClosed = errors.New("v8: Context has been closed")
+
+// Context represents an additional global scope within a Worker's JavaScript
+// VM. All of a Worker's Contexts share its heap, but each has its own globals,
+// $recv and $recvSync callbacks, and loaded modules, and none of them can
+// access the objects of another.
+//
+// Calls on a Context are serialized with calls on its Worker.
+type Context struct {
+	ctx    *C.worker_context
+	id     int32
+	worker *Worker
+}
+
+// Script represents JavaScript code that has been compiled independently of
+// any particular context, so that it can be run within any of a Worker's
+// contexts without being recompiled.
+type Script struct {
+	id     C.int
+	worker *Worker
+}
+
+// NewContext creates a new Context within the Worker. The given handlers serve
+// the $send and $sendSync calls made from within the Context in the same way
+// as Worker.HandleSend and Worker.HandleSendSync.
+func (w *Worker) NewContext(handleSend func(msg string) error, handleSendSync func(msg string) (response string, err error)) *Context {
+	c := &Context{worker: w}
+	w.runLocked(func() {
+		mutex.Lock()
+		w.instance.nextContextID++
+		c.id = w.instance.nextContextID
+		w.instance.contexts[c.id] = contextHandlers{handleSend, handleSendSync}
+		mutex.Unlock()
+
+		c.ctx = C.worker_context_create(w.instance.worker, C.int(c.id))
+	})
+	runtime.SetFinalizer(c, func(c *Context) {
+		c.Close()
+	})
+	return c
+}
+
+// CompileScript compiles JavaScript code with the given filename and source
+// code so that it can be run within any of the Worker's contexts.
+func (w *Worker) CompileScript(filename string, source string) (s *Script, err error) {
+	filenameStr := C.CString(filename)
+	sourceStr := C.CString(source)
+	defer C.free(unsafe.Pointer(filenameStr))
+	defer C.free(unsafe.Pointer(sourceStr))
+
+	w.runLocked(func() {
+		id := C.worker_compile_script(w.instance.worker, filenameStr, sourceStr)
+		if id < 0 {
+			err = w.getError()
+			return
+		}
+		s = &Script{id: id, worker: w}
+	})
+	return s, err
+}
+
+// RunScript runs a Script compiled by the Worker within its default context.
+func (w *Worker) RunScript(s *Script) (err error) {
+	if s.worker != w {
+		return errors.New("v8: Script was compiled by a different Worker")
+	}
+	w.runLocked(func() {
+		if C.worker_run_script(w.instance.worker, s.id) != 0 {
+			err = w.getError()
+		}
+	})
+	return err
+}
+
+// AllocatedBytes returns the approximate number of bytes that code running
+// within the Context has allocated on the Worker's heap, summed over all calls
+// into it. It is measured as the growth of the heap during each call, so memory
+// freed afterwards is never subtracted and a garbage collection during a call
+// hides what it reclaims. It's a measure of cumulative allocation, not of the
+// memory the Context currently retains, as V8 can't attribute live objects to
+// contexts.
+func (c *Context) AllocatedBytes() (n uint64) {
+	c.worker.runLocked(func() {
+		if c.ctx != nil {
+			n = uint64(C.worker_context_allocated(c.ctx))
+		}
+	})
+	return n
+}
+
+// Close frees the resources associated with the Context. It is safe to call
+// Close multiple times.
+func (c *Context) Close() {
+	c.worker.runLocked(func() {
+		if c.ctx == nil {
+			return
+		}
+		C.worker_context_destroy(c.ctx)
+		c.ctx = nil
+
+		mutex.Lock()
+		delete(c.worker.instance.contexts, c.id)
+		mutex.Unlock()
+	})
+}
+
+// LoadScript loads and executes JavaScript code with the given filename and
+// source code within the Context.
+func (c *Context) LoadScript(filename string, source string) (err error) {
+	filenameStr := C.CString(filename)
+	sourceStr := C.CString(source)
+	defer C.free(unsafe.Pointer(filenameStr))
+	defer C.free(unsafe.Pointer(sourceStr))
+
+	c.worker.runLocked(func() {
+		if c.ctx == nil {
+			err = errContextClosed
+		} else if C.worker_context_load_script(c.ctx, filenameStr, sourceStr) != 0 {
+			err = c.worker.getError()
+		}
+	})
+	return err
+}
+
+// RunScript runs a Script compiled by the Context's Worker within the Context.
+func (c *Context) RunScript(s *Script) (err error) {
+	if s.worker != c.worker {
+		return errors.New("v8: Script was compiled by a different Worker")
+	}
+	c.worker.runLocked(func() {
+		if c.ctx == nil {
+			err = errContextClosed
+		} else if C.worker_context_run_script(c.ctx, s.id) != 0 {
+			err = c.worker.getError()
+		}
+	})
+	return err
+}
+
+// Send a message, calling the Context's $recv callback in JavaScript.
+func (c *Context) Send(msg string) (err error) {
+	c.worker.runLocked(func() {
+		if c.ctx == nil {
+			err = errContextClosed
+		} else if C.worker_send_ctx(c.ctx, stringData(msg), C.int(len(msg))) != 0 {
+			err = c.worker.getError()
+		}
+	})
+	return err
+}
+
+// SendSync sends a message, calling the Context's $recvSync callback in
+// JavaScript. The return value of that callback will be passed back to the
+// caller in Go.
+func (c *Context) SendSync(msg string) (response string, err error) {
+	c.worker.runLocked(func() {
+		if c.ctx == nil {
+			err = errContextClosed
+			return
+		}
+		var resp *C.char
+		n := C.worker_send_sync_ctx(c.ctx, stringData(msg), C.int(len(msg)), &resp)
+		response = C.GoStringN(resp, n)
+	})
+	return response, err
+}
@@ -0,0 +1,88 @@
+package v8
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"strconv"
+	"strings"
+	"unsafe"
+)
+
+// JSONError is returned by SendJSON when the message isn't valid JSON.
+type JSONError struct {
+	// Message describes the SyntaxError raised by the JSON parser.
+	Message string
+	// Offset is the position within the message, in UTF-16 code units, at
+	// which parsing failed, or -1 if the parser didn't say. V8 only reports
+	// it within the text of Message, so it's taken from there on a best
+	// effort basis.
+	Offset int
+}
+
+func (e *JSONError) Error() string {
+	return "v8: invalid JSON: " + e.Message
+}
+
+// Convert the description of a SyntaxError raised by V8's JSON parser for the
+// given message, e.g. "SyntaxError: Unexpected token } in JSON at position 5",
+// into a JSONError. The offset is only used if the description ends with it,
+// as newer versions of V8 quote the message, which may itself contain the text
+// " at position ", and if it lies within the message.
+func newJSONError(desc string, msg []byte) *JSONError {
+	e := &JSONError{
+		Message: strings.TrimPrefix(desc, "SyntaxError: "),
+		Offset:  -1,
+	}
+	i := strings.LastIndex(e.Message, " at position ")
+	if i < 0 {
+		return e
+	}
+	digits := e.Message[i+len(" at position "):]
+	if digits == "" || strings.TrimLeft(digits, "0123456789") != "" {
+		return e
+	}
+	// A message has at most as many UTF-16 code units as UTF-8 bytes.
+	if offset, err := strconv.Atoi(digits); err == nil && offset <= len(msg) {
+		e.Offset = offset
+	}
+	return e
+}
+
+//export recvJSONCb
+func recvJSONCb(id int32, data *C.char, length C.int) *C.char {
+	cb := getInstance(id).handleSendJSON
+	if cb == nil {
+		return C.CString("v8: Worker.HandleSendJSON is nil")
+	}
+	if err := cb(C.GoBytes(unsafe.Pointer(data), length)); err != nil {
+		return C.CString(err.Error())
+	}
+	return nil
+}
+
+// SendJSON passes the given UTF-8 encoded JSON to the $recv callback in
+// JavaScript as the value it represents. The message is parsed natively, so
+// that the callback doesn't have to call JSON.parse on a string. If the
+// message isn't valid JSON, a *JSONError is returned.
+func (w *Worker) SendJSON(msg []byte) (err error) {
+	var data *C.char
+	if len(msg) > 0 {
+		data = (*C.char)(unsafe.Pointer(&msg[0]))
+	}
+	w.runLocked(func() {
+		switch C.worker_send_json(w.instance.worker, data, C.int(len(msg))) {
+		case 0:
+		case 3:
+			errStr := C.worker_last_exception(w.instance.worker)
+			defer C.free(unsafe.Pointer(errStr))
+			err = newJSONError(C.GoString(errStr), msg)
+		default:
+			err = w.getError()
+		}
+	})
+	return err
+}
@@ -0,0 +1,153 @@
+package v8
+
+/*
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"unsafe"
+)
+
+// owner is the goroutine of an Owned Worker that runs all calls into its
+// JavaScript VM instance. It's locked to its own OS thread, which keeps the
+// instance locked and entered for as long as it runs, and takes calls from a
+// lock-free multi-producer, single-consumer queue of commands.
+//
+// The queue is an intrusive linked list of commands. Producers swap themselves
+// in as the head and then link the previous head to their command, while the
+// owner follows the links from the tail, which is always the last command it
+// took. The owner parks on the wake channel when the queue is empty, and the
+// producer that finds it sleeping is responsible for waking it up.
+type owner struct {
+	head     unsafe.Pointer // *command
+	sleeping int32
+	tail     *command
+	wake     chan struct{}
+	worker   *C.worker
+}
+
+type command struct {
+	done  chan struct{}
+	fn    func()
+	next  unsafe.Pointer // *command
+	panic interface{}    // Recovered from fn, to be raised again by the caller.
+	stop  bool
+}
+
+// Channels for signalling the completion of commands. Commands themselves
+// can't be reused, as the last one taken stays in the queue.
+var commandDone = sync.Pool{
+	New: func() interface{} {
+		return make(chan struct{}, 1)
+	},
+}
+
+// Start the owner goroutine for the given instance.
+func startOwner(w *C.worker) *owner {
+	stub := &command{}
+	o := &owner{
+		head:   unsafe.Pointer(stub),
+		tail:   stub,
+		wake:   make(chan struct{}, 1),
+		worker: w,
+	}
+	started := make(chan struct{})
+	go o.loop(started)
+	<-started
+	return o
+}
+
+// Run fn on the owner thread and wait for it to return. Calls made from the
+// owner thread itself, e.g. by a handler called from JavaScript, run directly.
+func (o *owner) run(fn func()) {
+	if C.worker_locked_by_caller(o.worker) != 0 {
+		fn()
+		return
+	}
+	o.do(&command{fn: fn})
+}
+
+// Stop the owner goroutine, releasing the instance, and wait for it to exit.
+func (o *owner) stop() {
+	o.do(&command{stop: true})
+}
+
+func (o *owner) do(c *command) {
+	c.done = commandDone.Get().(chan struct{})
+	o.push(c)
+	<-c.done
+	commandDone.Put(c.done)
+	if c.panic != nil {
+		panic(c.panic)
+	}
+}
+
+// Run a command's fn, passing any panic back to the goroutine that is waiting
+// for it rather than letting it kill the owner goroutine.
+func (o *owner) call(c *command) {
+	defer func() {
+		c.panic = recover()
+	}()
+	c.fn()
+}
+
+func (o *owner) loop(started chan<- struct{}) {
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+
+	C.worker_own(o.worker)
+	close(started)
+	for {
+		c := o.pop()
+		if c == nil {
+			o.park()
+			continue
+		}
+		if c.stop {
+			C.worker_disown(o.worker)
+			c.done <- struct{}{}
+			return
+		}
+		o.call(c)
+		// The command stays in the queue as its tail, so drop the reference to
+		// the closure.
+		c.fn = nil
+		c.done <- struct{}{}
+	}
+}
+
+// Wait until a command has been pushed, unless one already has.
+func (o *owner) park() {
+	atomic.StoreInt32(&o.sleeping, 1)
+	if atomic.LoadPointer(&o.head) != unsafe.Pointer(o.tail) {
+		if atomic.CompareAndSwapInt32(&o.sleeping, 1, 0) {
+			return
+		}
+		// A producer has already cleared the flag and will send on wake.
+	}
+	<-o.wake
+}
+
+// Take the next command from the queue, or return nil if there isn't one. A
+// command may have been pushed without having been linked in yet, in which
+// case the caller parks and returns almost immediately.
+func (o *owner) pop() *command {
+	next := (*command)(atomic.LoadPointer(&o.tail.next))
+	if next == nil {
+		return nil
+	}
+	o.tail = next
+	return next
+}
+
+func (o *owner) push(c *command) {
+	prev := (*command)(atomic.SwapPointer(&o.head, unsafe.Pointer(c)))
+	atomic.StorePointer(&prev.next, unsafe.Pointer(c))
+	if atomic.LoadInt32(&o.sleeping) != 0 && atomic.CompareAndSwapInt32(&o.sleeping, 1, 0) {
+		o.wake <- struct{}{}
+	}
+}
@@ -0,0 +1,239 @@
+package v8
+
+import (
+	"errors"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+const defaultPoolHigh = 8
+
+var errPoolClosed = errors.New("v8: Pool has been closed")
+
+// Pool maintains a set of pre-initialised Workers so that callers don't have to
+// pay for creating a JavaScript VM instance on the request path. Idle Workers
+// are handed out by Get and the pool is refilled by a background goroutine
+// whenever the number of idle Workers drops below the low watermark.
+//
+// As with Worker, the configuration options must be set before Get is first
+// called.
+type Pool struct {
+	// These are accessed atomically and are kept at the top of the struct so
+	// that they're 64-bit aligned on 32-bit platforms.
+	hits        uint64
+	misses      uint64
+	refills     uint64
+	refillNanos uint64
+
+	// High is the number of idle Workers that the pool is refilled up to. It
+	// defaults to 8.
+	High int
+
+	// Low is the watermark below which the pool starts refilling. It defaults
+	// to half of High, or 1 if that's smaller.
+	Low int
+
+	// New returns a fresh Worker with its handlers and options set. It must not
+	// have had any of its methods called. If New is nil, a zero Worker is used.
+	New func() *Worker
+
+	// WarmUpFilename and WarmUpSource specify an optional script that is
+	// loaded into each Worker before it is added to the pool, e.g. to get hot
+	// functions compiled ahead of time.
+	WarmUpFilename string
+	WarmUpSource   string
+
+	closed bool
+	done   chan struct{}
+	idle   chan *Worker
+	mutex  sync.Mutex
+	refill chan struct{}
+}
+
+// PoolStats provides a snapshot of a Pool's metrics.
+type PoolStats struct {
+	// Hits and Misses count the calls to Get that were served from an idle
+	// Worker and those that had to create one on the spot.
+	Hits   uint64
+	Misses uint64
+
+	// Idle is the number of Workers currently in the pool.
+	Idle int
+
+	// Refills is the number of Workers created by the background goroutine,
+	// and RefillLatency is the mean time it took to create and warm up each
+	// of them.
+	Refills       uint64
+	RefillLatency time.Duration
+}
+
+// HitRate returns the fraction of calls to Get that were served from an idle
+// Worker.
+func (s PoolStats) HitRate() float64 {
+	total := s.Hits + s.Misses
+	if total == 0 {
+		return 0
+	}
+	return float64(s.Hits) / float64(total)
+}
+
+// Close stops the background refilling and disposes of any idle Workers.
+// Calls to Get after Close return an error.
+func (p *Pool) Close() {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	if p.closed {
+		return
+	}
+	p.closed = true
+	if p.done == nil {
+		return
+	}
+	close(p.done)
+	for {
+		select {
+		case w := <-p.idle:
+			discard(w)
+		default:
+			return
+		}
+	}
+}
+
+// Get returns an initialised Worker that is exclusively owned by the caller. If
+// there are no idle Workers, a new one is created synchronously.
+func (p *Pool) Get() (*Worker, error) {
+	if err := p.start(); err != nil {
+		return nil, err
+	}
+	select {
+	case w := <-p.idle:
+		atomic.AddUint64(&p.hits, 1)
+		if len(p.idle) < p.Low {
+			p.triggerRefill()
+		}
+		return w, nil
+	default:
+	}
+	atomic.AddUint64(&p.misses, 1)
+	p.triggerRefill()
+	return p.create()
+}
+
+// Stats returns the current metrics for the pool.
+func (p *Pool) Stats() PoolStats {
+	s := PoolStats{
+		Hits:    atomic.LoadUint64(&p.hits),
+		Misses:  atomic.LoadUint64(&p.misses),
+		Refills: atomic.LoadUint64(&p.refills),
+	}
+	if s.Refills > 0 {
+		s.RefillLatency = time.Duration(atomic.LoadUint64(&p.refillNanos) / s.Refills)
+	}
+	p.mutex.Lock()
+	if p.idle != nil {
+		s.Idle = len(p.idle)
+	}
+	p.mutex.Unlock()
+	return s
+}
+
+// Create and warm up a new Worker. If the warm-up script fails, the Worker is
+// disposed of straight away.
+func (p *Pool) create() (*Worker, error) {
+	var w *Worker
+	if p.New != nil {
+		w = p.New()
+	} else {
+		w = &Worker{}
+	}
+	w.mutex.Lock()
+	w.init()
+	w.mutex.Unlock()
+	if p.WarmUpSource != "" {
+		if err := w.LoadScript(p.WarmUpFilename, p.WarmUpSource); err != nil {
+			discard(w)
+			return nil, err
+		}
+	}
+	return w, nil
+}
+
+// Dispose of a Worker that will never be handed out, rather than leaving it to
+// the finalizer.
+func discard(w *Worker) {
+	runtime.SetFinalizer(w, nil)
+	w.dispose()
+}
+
+// Refill the pool up to the high watermark whenever signalled.
+func (p *Pool) run() {
+	for {
+		select {
+		case <-p.done:
+			return
+		case <-p.refill:
+		}
+		for len(p.idle) < p.High {
+			start := time.Now()
+			w, err := p.create()
+			if err != nil {
+				// The error will surface to callers of Get when they miss.
+				break
+			}
+			atomic.AddUint64(&p.refillNanos, uint64(time.Since(start)))
+			atomic.AddUint64(&p.refills, 1)
+			// Close may have drained the pool while the Worker was being
+			// created, in which case it's no longer wanted.
+			p.mutex.Lock()
+			if p.closed {
+				p.mutex.Unlock()
+				discard(w)
+				return
+			}
+			select {
+			case p.idle <- w:
+			default:
+				discard(w)
+			}
+			p.mutex.Unlock()
+		}
+	}
+}
+
+// Start the background goroutine on first use.
+func (p *Pool) start() error {
+	p.mutex.Lock()
+	defer p.mutex.Unlock()
+	if p.closed {
+		return errPoolClosed
+	}
+	if p.done != nil {
+		return nil
+	}
+	if p.High <= 0 {
+		p.High = defaultPoolHigh
+	}
+	if p.Low <= 0 || p.Low > p.High {
+		p.Low = p.High / 2
+		if p.Low < 1 {
+			p.Low = 1
+		}
+	}
+	p.done = make(chan struct{})
+	p.idle = make(chan *Worker, p.High)
+	p.refill = make(chan struct{}, 1)
+	go p.run()
+	p.triggerRefill()
+	return nil
+}
+
+// Wake up the background goroutine if it isn't already due to run.
+func (p *Pool) triggerRefill() {
+	select {
+	case p.refill <- struct{}{}:
+	default:
+	}
+}
@@ -0,0 +1,109 @@
+package v8
+
+/*
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"time"
+	"unsafe"
+)
+
+// SendQueue configures a Worker to queue the messages sent with $send and
+// deliver them to HandleSend in batches on a separate goroutine, instead of
+// calling HandleSend synchronously for each message. This lets JavaScript that
+// emits many messages carry on without waiting for Go.
+//
+// Queued messages are handed to Go whenever control returns from JavaScript,
+// or earlier once one of the flush thresholds is reached. If Backlog batches
+// are already awaiting delivery, the JavaScript VM blocks until HandleSend
+// catches up. So HandleSend must not synchronously call methods on the Worker
+// that it's handling messages for.
+type SendQueue struct {
+	// Backlog is the number of batches that may be awaiting delivery before
+	// JavaScript is blocked. It defaults to 16.
+	Backlog int
+
+	// FlushBytes is the total size of queued messages at which they are
+	// flushed. It defaults to 64KiB.
+	FlushBytes int
+
+	// FlushInterval is the age of the oldest queued message at which the
+	// queue is flushed by the next $send call. It defaults to 1ms.
+	FlushInterval time.Duration
+
+	// FlushSize is the number of queued messages at which they are flushed.
+	// It defaults to 256.
+	FlushSize int
+}
+
+type queuedMessage struct {
+	ctx int32
+	msg string
+}
+
+// Enable the native queue for the given instance and start delivering its
+// batches.
+func (q *SendQueue) start(i *instance) {
+	backlog := q.Backlog
+	if backlog <= 0 {
+		backlog = 16
+	}
+	flushBytes := q.FlushBytes
+	if flushBytes <= 0 {
+		flushBytes = 64 << 10
+	}
+	flushInterval := q.FlushInterval
+	if flushInterval <= 0 {
+		flushInterval = time.Millisecond
+	}
+	flushSize := q.FlushSize
+	if flushSize <= 0 {
+		flushSize = 256
+	}
+	i.sendQueue = make(chan []queuedMessage, backlog)
+	C.worker_enable_send_queue(i.worker, C.int(flushSize), C.int(flushBytes), C.int(flushInterval/time.Microsecond))
+	go i.deliverSends()
+}
+
+// Pass queued messages to the handlers of the contexts that sent them. This
+// runs until the channel is closed when the Worker is disposed.
+func (i *instance) deliverSends() {
+	for batch := range i.sendQueue {
+		for _, m := range batch {
+			cb, _ := i.handlers(m.ctx)
+			if cb != nil {
+				cb(m.msg)
+			}
+		}
+	}
+}
+
+//export flushSendQueue
+func flushSendQueue(id int32, count C.int, ctxs *C.int, msgs **C.char, lengths *C.int) {
+	// Messages that are flushed while the Worker is being disposed are
+	// dropped, as the delivery channel is about to be closed.
+	i := getInstance(id)
+	if i == nil {
+		return
+	}
+	i.settleMutex.RLock()
+	disposed := i.disposed
+	i.settleMutex.RUnlock()
+	if disposed {
+		return
+	}
+	n := int(count)
+	ctxSlice := (*[1 << 28]C.int)(unsafe.Pointer(ctxs))[:n:n]
+	msgSlice := (*[1 << 28]*C.char)(unsafe.Pointer(msgs))[:n:n]
+	lengthSlice := (*[1 << 28]C.int)(unsafe.Pointer(lengths))[:n:n]
+	batch := make([]queuedMessage, n)
+	for j := range batch {
+		batch[j] = queuedMessage{
+			ctx: int32(ctxSlice[j]),
+			msg: C.GoStringN(msgSlice[j], lengthSlice[j]),
+		}
+	}
+	i.sendQueue <- batch
+}
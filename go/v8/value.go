@@ -0,0 +1,827 @@
+package v8
+
+/*
+#include <stdlib.h>
+#include "binding.h"
+*/
+import "C"
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"math"
+	"sort"
+	"strconv"
+	"time"
+	"unicode/utf16"
+	"unsafe"
+)
+
+// The version of V8's structured serialization format that EncodeValue emits.
+const valueFormatVersion = 13
+
+// The largest sparse array that DecodeValue will expand into a slice.
+const maxSparseArrayLength = 1 << 24
+
+// The tags of V8's structured serialization format.
+const (
+	tagVersion           = 0xff
+	tagPadding           = '\x00'
+	tagVerifyObjectCount = '?'
+	tagTheHole           = '-'
+	tagUndefined         = '_'
+	tagNull              = '0'
+	tagTrue              = 'T'
+	tagFalse             = 'F'
+	tagInt32             = 'I'
+	tagUint32            = 'U'
+	tagDouble            = 'N'
+	tagUtf8String        = 'S'
+	tagOneByteString     = '"'
+	tagTwoByteString     = 'c'
+	tagObjectReference   = '^'
+	tagBeginJSObject     = 'o'
+	tagEndJSObject       = '{'
+	tagBeginSparseArray  = 'a'
+	tagEndSparseArray    = '@'
+	tagBeginDenseArray   = 'A'
+	tagEndDenseArray     = '$'
+	tagDate              = 'D'
+	tagTrueObject        = 'y'
+	tagFalseObject       = 'x'
+	tagNumberObject      = 'n'
+	tagStringObject      = 's'
+	tagBeginJSMap        = ';'
+	tagEndJSMap          = ':'
+	tagBeginJSSet        = '\''
+	tagEndJSSet          = ','
+	tagArrayBuffer       = 'B'
+	tagArrayBufferView   = 'V'
+)
+
+// The subtags identifying the type of an ArrayBuffer view.
+const (
+	viewInt8         = 'b'
+	viewUint8        = 'B'
+	viewUint8Clamped = 'C'
+	viewInt16        = 'w'
+	viewUint16       = 'W'
+	viewInt32        = 'd'
+	viewUint32       = 'D'
+	viewFloat32      = 'f'
+	viewFloat64      = 'F'
+	viewDataView     = '?'
+)
+
+var errValueTruncated = errors.New("v8: truncated value data")
+
+// ArrayBuffer represents the contents of a JavaScript ArrayBuffer. Byte slices
+// correspond to Uint8Arrays instead.
+type ArrayBuffer []byte
+
+// Map represents a JavaScript Map, with its entries in insertion order.
+type Map struct {
+	Entries []MapEntry
+}
+
+// MapEntry is a single key/value pair within a Map.
+type MapEntry struct {
+	Key   interface{}
+	Value interface{}
+}
+
+// Set represents a JavaScript Set, with its values in insertion order.
+type Set struct {
+	Values []interface{}
+}
+
+// Undefined represents the JavaScript undefined value, as well as holes within
+// arrays. JavaScript null corresponds to nil.
+type Undefined struct{}
+
+// DecodeValue decodes data in V8's structured serialization format, as
+// produced by $sendValue, into Go values:
+//
+//	undefined            Undefined
+//	null                 nil
+//	booleans             bool
+//	numbers              float64
+//	strings              string
+//	arrays               []interface{}
+//	objects              map[string]interface{}
+//	Map                  *Map
+//	Set                  *Set
+//	Date                 time.Time
+//	ArrayBuffer          ArrayBuffer
+//	Uint8Array           []byte
+//	Uint8ClampedArray    []byte
+//	DataView             []byte
+//	Int8Array            []int8
+//	Int16Array           []int16
+//	Uint16Array          []uint16
+//	Int32Array           []int32
+//	Uint32Array          []uint32
+//	Float32Array         []float32
+//	Float64Array         []float64
+//
+// Boolean, Number and String objects decode to their primitive values. Other
+// types, e.g. RegExp, result in an error. Repeated references to the same
+// object decode to the same Go value, so a byte slice may share its memory with
+// the ArrayBuffer or other views it was created from.
+func DecodeValue(data []byte) (interface{}, error) {
+	d := &valueDecoder{data: data}
+	if len(data) > 0 && data[0] == tagVersion {
+		d.pos++
+		version, err := d.readVarint()
+		if err != nil {
+			return nil, err
+		}
+		if version > valueFormatVersion {
+			return nil, fmt.Errorf("v8: unsupported value format version %d", version)
+		}
+	}
+	return d.readValue()
+}
+
+// EncodeValue encodes a Go value in V8's structured serialization format, so
+// that it can be passed to SendValue. It accepts the same types that
+// DecodeValue produces, as well as Go's other integer and float types, and
+// pointers to Map and Set values. Values must not contain cycles.
+func EncodeValue(v interface{}) ([]byte, error) {
+	e := &valueEncoder{buf: []byte{tagVersion, valueFormatVersion}}
+	if err := e.writeValue(v); err != nil {
+		return nil, err
+	}
+	return e.buf, nil
+}
+
+type valueDecoder struct {
+	data    []byte
+	objects []interface{}
+	pos     int
+}
+
+// Record an object under the next id so that later references can be
+// resolved, and return the id.
+func (d *valueDecoder) addObject(v interface{}) int {
+	d.objects = append(d.objects, v)
+	return len(d.objects) - 1
+}
+
+func (d *valueDecoder) readArrayBufferView(buf ArrayBuffer) (interface{}, error) {
+	subtag, err := d.readByte()
+	if err != nil {
+		return nil, err
+	}
+	offset, err := d.readVarint()
+	if err != nil {
+		return nil, err
+	}
+	length, err := d.readVarint()
+	if err != nil {
+		return nil, err
+	}
+	if offset > uint64(len(buf)) || length > uint64(len(buf))-offset {
+		return nil, errors.New("v8: invalid ArrayBuffer view bounds")
+	}
+	b := buf[offset : offset+length]
+	var v interface{}
+	switch subtag {
+	case viewUint8, viewUint8Clamped, viewDataView:
+		v = []byte(b)
+	case viewInt8:
+		s := make([]int8, len(b))
+		for i := range s {
+			s[i] = int8(b[i])
+		}
+		v = s
+	case viewInt16:
+		s := make([]int16, len(b)/2)
+		for i := range s {
+			s[i] = int16(binary.LittleEndian.Uint16(b[2*i:]))
+		}
+		v = s
+	case viewUint16:
+		s := make([]uint16, len(b)/2)
+		for i := range s {
+			s[i] = binary.LittleEndian.Uint16(b[2*i:])
+		}
+		v = s
+	case viewInt32:
+		s := make([]int32, len(b)/4)
+		for i := range s {
+			s[i] = int32(binary.LittleEndian.Uint32(b[4*i:]))
+		}
+		v = s
+	case viewUint32:
+		s := make([]uint32, len(b)/4)
+		for i := range s {
+			s[i] = binary.LittleEndian.Uint32(b[4*i:])
+		}
+		v = s
+	case viewFloat32:
+		s := make([]float32, len(b)/4)
+		for i := range s {
+			s[i] = math.Float32frombits(binary.LittleEndian.Uint32(b[4*i:]))
+		}
+		v = s
+	case viewFloat64:
+		s := make([]float64, len(b)/8)
+		for i := range s {
+			s[i] = math.Float64frombits(binary.LittleEndian.Uint64(b[8*i:]))
+		}
+		v = s
+	default:
+		return nil, fmt.Errorf("v8: unsupported ArrayBuffer view type %q", subtag)
+	}
+	d.addObject(v)
+	return v, nil
+}
+
+func (d *valueDecoder) readByte() (byte, error) {
+	if d.pos >= len(d.data) {
+		return 0, errValueTruncated
+	}
+	b := d.data[d.pos]
+	d.pos++
+	return b, nil
+}
+
+func (d *valueDecoder) readBytes(n uint64) ([]byte, error) {
+	if n > uint64(len(d.data)-d.pos) {
+		return nil, errValueTruncated
+	}
+	b := d.data[d.pos : d.pos+int(n)]
+	d.pos += int(n)
+	return b, nil
+}
+
+func (d *valueDecoder) readDouble() (float64, error) {
+	b, err := d.readBytes(8)
+	if err != nil {
+		return 0, err
+	}
+	return math.Float64frombits(binary.LittleEndian.Uint64(b)), nil
+}
+
+// Read the key/value pairs of an object or array up to the given end tag, and
+// then the trailing property count.
+func (d *valueDecoder) readProperties(end byte, set func(key interface{}, value interface{})) error {
+	for {
+		tag, err := d.peekTag()
+		if err != nil {
+			return err
+		}
+		if tag == end {
+			d.pos++
+			break
+		}
+		key, err := d.readValue()
+		if err != nil {
+			return err
+		}
+		value, err := d.readValue()
+		if err != nil {
+			return err
+		}
+		set(key, value)
+	}
+	_, err := d.readVarint()
+	return err
+}
+
+// Read the tag of a string value, followed by the string.
+func (d *valueDecoder) readString() (string, error) {
+	tag, err := d.readTag()
+	if err != nil {
+		return "", err
+	}
+	return d.readStringBody(tag)
+}
+
+func (d *valueDecoder) readStringBody(tag byte) (string, error) {
+	n, err := d.readVarint()
+	if err != nil {
+		return "", err
+	}
+	b, err := d.readBytes(n)
+	if err != nil {
+		return "", err
+	}
+	switch tag {
+	case tagUtf8String:
+		return string(b), nil
+	case tagOneByteString:
+		r := make([]rune, len(b))
+		for i, c := range b {
+			r[i] = rune(c)
+		}
+		return string(r), nil
+	case tagTwoByteString:
+		if len(b)%2 != 0 {
+			return "", errors.New("v8: invalid two-byte string length")
+		}
+		u := make([]uint16, len(b)/2)
+		for i := range u {
+			u[i] = binary.LittleEndian.Uint16(b[2*i:])
+		}
+		return string(utf16.Decode(u)), nil
+	}
+	return "", fmt.Errorf("v8: expected a string, got tag %q", tag)
+}
+
+// Return the next tag without consuming it.
+func (d *valueDecoder) peekTag() (byte, error) {
+	for d.pos < len(d.data) && d.data[d.pos] == tagPadding {
+		d.pos++
+	}
+	if d.pos >= len(d.data) {
+		return 0, errValueTruncated
+	}
+	return d.data[d.pos], nil
+}
+
+func (d *valueDecoder) readTag() (byte, error) {
+	tag, err := d.peekTag()
+	if err == nil {
+		d.pos++
+	}
+	return tag, err
+}
+
+// V8 writes an ArrayBuffer view as its ArrayBuffer, or a reference to an
+// ArrayBuffer that has already been written, followed by the view itself. So
+// any ArrayBuffer may turn out to be the start of a view.
+func (d *valueDecoder) readValue() (interface{}, error) {
+	v, err := d.readObject()
+	if err != nil {
+		return nil, err
+	}
+	if buf, ok := v.(ArrayBuffer); ok {
+		if tag, err := d.peekTag(); err == nil && tag == tagArrayBufferView {
+			d.pos++
+			return d.readArrayBufferView(buf)
+		}
+	}
+	return v, nil
+}
+
+func (d *valueDecoder) readObject() (interface{}, error) {
+	tag, err := d.readTag()
+	if err != nil {
+		return nil, err
+	}
+	switch tag {
+	case tagVerifyObjectCount:
+		if _, err := d.readVarint(); err != nil {
+			return nil, err
+		}
+		return d.readValue()
+	case tagUndefined, tagTheHole:
+		return Undefined{}, nil
+	case tagNull:
+		return nil, nil
+	case tagTrue:
+		return true, nil
+	case tagFalse:
+		return false, nil
+	case tagInt32:
+		n, err := d.readVarint()
+		if err != nil {
+			return nil, err
+		}
+		return float64(int32(uint32(n>>1) ^ -uint32(n&1))), nil
+	case tagUint32:
+		n, err := d.readVarint()
+		if err != nil {
+			return nil, err
+		}
+		return float64(uint32(n)), nil
+	case tagDouble:
+		return d.readDouble()
+	case tagUtf8String, tagOneByteString, tagTwoByteString:
+		return d.readStringBody(tag)
+	case tagObjectReference:
+		id, err := d.readVarint()
+		if err != nil {
+			return nil, err
+		}
+		if id >= uint64(len(d.objects)) {
+			return nil, fmt.Errorf("v8: invalid object reference %d", id)
+		}
+		return d.objects[id], nil
+	case tagBeginJSObject:
+		obj := map[string]interface{}{}
+		d.addObject(obj)
+		err := d.readProperties(tagEndJSObject, func(key interface{}, value interface{}) {
+			obj[propertyKey(key)] = value
+		})
+		return obj, err
+	case tagBeginDenseArray, tagBeginSparseArray:
+		length, err := d.readVarint()
+		if err != nil {
+			return nil, err
+		}
+		if tag == tagBeginDenseArray && length > uint64(len(d.data)) {
+			return nil, errValueTruncated
+		}
+		if length > maxSparseArrayLength {
+			return nil, fmt.Errorf("v8: array of length %d is too large to decode", length)
+		}
+		arr := make([]interface{}, length)
+		d.addObject(arr)
+		end := byte(tagEndSparseArray)
+		if tag == tagBeginDenseArray {
+			end = tagEndDenseArray
+			for i := range arr {
+				if arr[i], err = d.readValue(); err != nil {
+					return nil, err
+				}
+			}
+		} else {
+			for i := range arr {
+				arr[i] = Undefined{}
+			}
+		}
+		err = d.readProperties(end, func(key interface{}, value interface{}) {
+			// Non-index properties of arrays are dropped.
+			if idx, ok := key.(float64); ok && idx >= 0 && idx < float64(len(arr)) && idx == math.Trunc(idx) {
+				arr[int(idx)] = value
+			}
+		})
+		if err != nil {
+			return nil, err
+		}
+		// The trailing length is only needed by JavaScript.
+		_, err = d.readVarint()
+		return arr, err
+	case tagDate:
+		ms, err := d.readDouble()
+		if err != nil {
+			return nil, err
+		}
+		sec := math.Floor(ms / 1000)
+		t := time.Unix(int64(sec), int64((ms-sec*1000)*1e6))
+		d.addObject(t)
+		return t, nil
+	case tagTrueObject, tagFalseObject:
+		v := tag == tagTrueObject
+		d.addObject(v)
+		return v, nil
+	case tagNumberObject:
+		v, err := d.readDouble()
+		if err != nil {
+			return nil, err
+		}
+		d.addObject(v)
+		return v, nil
+	case tagStringObject:
+		v, err := d.readString()
+		if err != nil {
+			return nil, err
+		}
+		d.addObject(v)
+		return v, nil
+	case tagBeginJSMap:
+		m := &Map{}
+		d.addObject(m)
+		for {
+			tag, err := d.peekTag()
+			if err != nil {
+				return nil, err
+			}
+			if tag == tagEndJSMap {
+				d.pos++
+				break
+			}
+			key, err := d.readValue()
+			if err != nil {
+				return nil, err
+			}
+			value, err := d.readValue()
+			if err != nil {
+				return nil, err
+			}
+			m.Entries = append(m.Entries, MapEntry{key, value})
+		}
+		_, err := d.readVarint()
+		return m, err
+	case tagBeginJSSet:
+		s := &Set{}
+		d.addObject(s)
+		for {
+			tag, err := d.peekTag()
+			if err != nil {
+				return nil, err
+			}
+			if tag == tagEndJSSet {
+				d.pos++
+				break
+			}
+			value, err := d.readValue()
+			if err != nil {
+				return nil, err
+			}
+			s.Values = append(s.Values, value)
+		}
+		_, err := d.readVarint()
+		return s, err
+	case tagArrayBuffer:
+		n, err := d.readVarint()
+		if err != nil {
+			return nil, err
+		}
+		b, err := d.readBytes(n)
+		if err != nil {
+			return nil, err
+		}
+		buf := ArrayBuffer(b)
+		d.addObject(buf)
+		return buf, nil
+	}
+	return nil, fmt.Errorf("v8: unsupported value tag %q", tag)
+}
+
+func (d *valueDecoder) readVarint() (uint64, error) {
+	var v uint64
+	for shift := uint(0); shift < 64; shift += 7 {
+		b, err := d.readByte()
+		if err != nil {
+			return 0, err
+		}
+		v |= uint64(b&0x7f) << shift
+		if b < 0x80 {
+			return v, nil
+		}
+	}
+	return 0, errors.New("v8: invalid varint")
+}
+
+type valueEncoder struct {
+	buf []byte
+}
+
+func (e *valueEncoder) writeArrayBuffer(b []byte) {
+	e.buf = append(e.buf, tagArrayBuffer)
+	e.writeVarint(uint64(len(b)))
+	e.buf = append(e.buf, b...)
+}
+
+func (e *valueEncoder) writeDouble(f float64) {
+	e.buf = append(e.buf, tagDouble)
+	e.writeFloat64(f)
+}
+
+func (e *valueEncoder) writeFloat64(f float64) {
+	var b [8]byte
+	binary.LittleEndian.PutUint64(b[:], math.Float64bits(f))
+	e.buf = append(e.buf, b[:]...)
+}
+
+func (e *valueEncoder) writeInt(n int64) {
+	if n < math.MinInt32 || n > math.MaxInt32 {
+		e.writeDouble(float64(n))
+		return
+	}
+	e.buf = append(e.buf, tagInt32)
+	e.writeVarint(uint64(uint32((int32(n) << 1) ^ (int32(n) >> 31))))
+}
+
+func (e *valueEncoder) writeString(s string) {
+	oneByte := true
+	for _, r := range s {
+		if r > 0xff {
+			oneByte = false
+			break
+		}
+	}
+	if oneByte {
+		b := make([]byte, 0, len(s))
+		for _, r := range s {
+			b = append(b, byte(r))
+		}
+		e.buf = append(e.buf, tagOneByteString)
+		e.writeVarint(uint64(len(b)))
+		e.buf = append(e.buf, b...)
+		return
+	}
+	u := utf16.Encode([]rune(s))
+	e.buf = append(e.buf, tagTwoByteString)
+	e.writeVarint(uint64(2 * len(u)))
+	for _, c := range u {
+		e.buf = append(e.buf, byte(c), byte(c>>8))
+	}
+}
+
+func (e *valueEncoder) writeValue(v interface{}) error {
+	switch v := v.(type) {
+	case nil:
+		e.buf = append(e.buf, tagNull)
+	case Undefined:
+		e.buf = append(e.buf, tagUndefined)
+	case bool:
+		if v {
+			e.buf = append(e.buf, tagTrue)
+		} else {
+			e.buf = append(e.buf, tagFalse)
+		}
+	case int:
+		e.writeInt(int64(v))
+	case int8:
+		e.writeInt(int64(v))
+	case int16:
+		e.writeInt(int64(v))
+	case int32:
+		e.writeInt(int64(v))
+	case int64:
+		e.writeInt(v)
+	case uint:
+		e.writeUint(uint64(v))
+	case uint8:
+		e.writeUint(uint64(v))
+	case uint16:
+		e.writeUint(uint64(v))
+	case uint32:
+		e.writeUint(uint64(v))
+	case uint64:
+		e.writeUint(v)
+	case float32:
+		e.writeDouble(float64(v))
+	case float64:
+		e.writeDouble(v)
+	case string:
+		e.writeString(v)
+	case []interface{}:
+		e.buf = append(e.buf, tagBeginDenseArray)
+		e.writeVarint(uint64(len(v)))
+		for _, elem := range v {
+			if err := e.writeValue(elem); err != nil {
+				return err
+			}
+		}
+		e.buf = append(e.buf, tagEndDenseArray)
+		e.writeVarint(0)
+		e.writeVarint(uint64(len(v)))
+	case map[string]interface{}:
+		keys := make([]string, 0, len(v))
+		for key := range v {
+			keys = append(keys, key)
+		}
+		sort.Strings(keys)
+		e.buf = append(e.buf, tagBeginJSObject)
+		for _, key := range keys {
+			e.writeString(key)
+			if err := e.writeValue(v[key]); err != nil {
+				return err
+			}
+		}
+		e.buf = append(e.buf, tagEndJSObject)
+		e.writeVarint(uint64(len(keys)))
+	case Map:
+		return e.writeValue(&v)
+	case *Map:
+		e.buf = append(e.buf, tagBeginJSMap)
+		for _, entry := range v.Entries {
+			if err := e.writeValue(entry.Key); err != nil {
+				return err
+			}
+			if err := e.writeValue(entry.Value); err != nil {
+				return err
+			}
+		}
+		e.buf = append(e.buf, tagEndJSMap)
+		e.writeVarint(uint64(2 * len(v.Entries)))
+	case Set:
+		return e.writeValue(&v)
+	case *Set:
+		e.buf = append(e.buf, tagBeginJSSet)
+		for _, elem := range v.Values {
+			if err := e.writeValue(elem); err != nil {
+				return err
+			}
+		}
+		e.buf = append(e.buf, tagEndJSSet)
+		e.writeVarint(uint64(len(v.Values)))
+	case time.Time:
+		e.buf = append(e.buf, tagDate)
+		e.writeFloat64(float64(v.Unix())*1000 + float64(v.Nanosecond())/1e6)
+	case ArrayBuffer:
+		e.writeArrayBuffer(v)
+	case []byte:
+		e.writeView(viewUint8, v)
+	case []int8:
+		b := make([]byte, len(v))
+		for i, n := range v {
+			b[i] = byte(n)
+		}
+		e.writeView(viewInt8, b)
+	case []int16:
+		b := make([]byte, 2*len(v))
+		for i, n := range v {
+			binary.LittleEndian.PutUint16(b[2*i:], uint16(n))
+		}
+		e.writeView(viewInt16, b)
+	case []uint16:
+		b := make([]byte, 2*len(v))
+		for i, n := range v {
+			binary.LittleEndian.PutUint16(b[2*i:], n)
+		}
+		e.writeView(viewUint16, b)
+	case []int32:
+		b := make([]byte, 4*len(v))
+		for i, n := range v {
+			binary.LittleEndian.PutUint32(b[4*i:], uint32(n))
+		}
+		e.writeView(viewInt32, b)
+	case []uint32:
+		b := make([]byte, 4*len(v))
+		for i, n := range v {
+			binary.LittleEndian.PutUint32(b[4*i:], n)
+		}
+		e.writeView(viewUint32, b)
+	case []float32:
+		b := make([]byte, 4*len(v))
+		for i, n := range v {
+			binary.LittleEndian.PutUint32(b[4*i:], math.Float32bits(n))
+		}
+		e.writeView(viewFloat32, b)
+	case []float64:
+		b := make([]byte, 8*len(v))
+		for i, n := range v {
+			binary.LittleEndian.PutUint64(b[8*i:], math.Float64bits(n))
+		}
+		e.writeView(viewFloat64, b)
+	default:
+		return fmt.Errorf("v8: unsupported value type %T", v)
+	}
+	return nil
+}
+
+func (e *valueEncoder) writeUint(n uint64) {
+	if n > math.MaxInt32 {
+		e.writeDouble(float64(n))
+		return
+	}
+	e.writeInt(int64(n))
+}
+
+func (e *valueEncoder) writeVarint(n uint64) {
+	for n >= 0x80 {
+		e.buf = append(e.buf, byte(n)|0x80)
+		n >>= 7
+	}
+	e.buf = append(e.buf, byte(n))
+}
+
+// Write a typed array view along with the ArrayBuffer holding its contents.
+func (e *valueEncoder) writeView(subtag byte, b []byte) {
+	e.writeArrayBuffer(b)
+	e.buf = append(e.buf, tagArrayBufferView, subtag)
+	e.writeVarint(0)
+	e.writeVarint(uint64(len(b)))
+}
+
+// Convert a decoded property key into its JavaScript string form.
+func propertyKey(key interface{}) string {
+	switch k := key.(type) {
+	case string:
+		return k
+	case float64:
+		return strconv.FormatFloat(k, 'f', -1, 64)
+	}
+	return fmt.Sprint(key)
+}
+
+//export recvValueCb
+func recvValueCb(id int32, data unsafe.Pointer, length C.size_t) *C.char {
+	cb := getInstance(id).handleSendValue
+	if cb == nil {
+		return C.CString("v8: Worker.HandleSendValue is nil")
+	}
+	v, err := DecodeValue(C.GoBytes(data, C.int(length)))
+	if err == nil {
+		err = cb(v)
+	}
+	if err != nil {
+		return C.CString(err.Error())
+	}
+	return nil
+}
+
+// SendValue encodes the given value with EncodeValue and passes the resulting
+// JavaScript value to the $recv callback. Unlike sending JSON, this preserves
+// Maps, Sets, Dates and typed arrays, with the latter travelling as raw bytes.
+func (w *Worker) SendValue(v interface{}) error {
+	data, err := EncodeValue(v)
+	if err != nil {
+		return err
+	}
+
+	w.runLocked(func() {
+		if C.worker_send_value(w.instance.worker, (*C.char)(unsafe.Pointer(&data[0])), C.int(len(data))) != 0 {
+			err = w.getError()
+		}
+	})
+	return err
+}
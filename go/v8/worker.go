@@ -15,6 +15,7 @@ import "C"
 
 import (
 	"errors"
+	"io"
 	"runtime"
 	"sync"
 	"unsafe"
@@ -25,14 +26,130 @@ var nextID int32
 var once sync.Once
 var registry = make(map[int32]*instance)
 
+// Reusable buffers for packing batches of messages into a single block of
+// memory that C can borrow.
+var batchBuffers = sync.Pool{
+	New: func() interface{} {
+		return &batchBuffer{}
+	},
+}
+
+type batchBuffer struct {
+	data    []byte
+	lengths []C.int
+}
+
+// Return a pointer to the packed messages, or nil if they're all empty.
+func (b *batchBuffer) dataPtr() *C.char {
+	if len(b.data) == 0 {
+		return nil
+	}
+	return (*C.char)(unsafe.Pointer(&b.data[0]))
+}
+
 // Internal struct which is stored in the registry map using the weakref
 // pattern.
 type instance struct {
-	getModuleSource func(string) (string, error)
-	handleSend      func(string) error
-	handleSendSync  func(string) (string, error)
-	id              int32
-	worker          *C.worker
+	asyncCalls       map[int32]chan Result
+	batchModuleFetch bool
+	channelPoisoned  func()
+	channelReadable  chan struct{}
+	channelWritable  chan struct{}
+	contexts         map[int32]contextHandlers
+	disposed         bool
+	getModuleSource  func(string) (string, error)
+	handleSend       func(string) error
+	handleSendAsync  func(string) (string, error)
+	handleSendBuffer func(*Buffer)
+	handleSendJSON   func([]byte) error
+	handleSendSync   func(string) (string, error)
+	handleSendValue  func(interface{}) error
+	id               int32
+	lastAsyncCall    int32
+	nextContextID    int32
+	owner            *owner
+	resolveModuleURL func(string, string) (string, error)
+	sendQueue        chan []queuedMessage
+	settleMutex      sync.RWMutex
+	snapshot         *Snapshot
+	syncResponse     unsafe.Pointer
+	syncResponseCap  int
+	worker           *C.worker
+}
+
+// Snapshot represents a V8 startup snapshot of a worker's global scope after a
+// bootstrap script has been run. Workers created from a Snapshot are
+// deserialized from it instead of having to rebuild their global scope and
+// re-evaluate the bootstrap script.
+//
+// A Snapshot may be shared by any number of Workers.
+type Snapshot struct {
+	snapshot C.worker_snapshot
+}
+
+// NewSnapshot runs the bootstrap script with the given filename and source code
+// in a fresh JavaScript VM and returns a Snapshot of the resulting state. The
+// $send and $sendSync functions raise exceptions when called by the bootstrap
+// script, but any callbacks registered with $recv and $recvSync will be
+// available within Workers created from the Snapshot.
+func NewSnapshot(filename string, source string, enablePrint bool) (*Snapshot, error) {
+	initV8()
+
+	filenameStr := C.CString(filename)
+	sourceStr := C.CString(source)
+	defer C.free(unsafe.Pointer(filenameStr))
+	defer C.free(unsafe.Pointer(sourceStr))
+
+	var print int32
+	if enablePrint {
+		print = 1
+	}
+
+	s := &Snapshot{}
+	var err *C.char
+	r := C.worker_create_snapshot(filenameStr, sourceStr, C.int(print), &s.snapshot, &err)
+	if r != 0 {
+		defer C.free(unsafe.Pointer(err))
+		return nil, errors.New(C.GoString(err))
+	}
+
+	runtime.SetFinalizer(s, func(s *Snapshot) {
+		C.worker_snapshot_dispose(&s.snapshot)
+	})
+	return s, nil
+}
+
+// Size returns the size of the serialized snapshot in bytes.
+func (s *Snapshot) Size() int {
+	return int(s.snapshot.size)
+}
+
+// The handlers for a Context. These are held separately from the Context so
+// that the registry doesn't keep it from being garbage collected.
+type contextHandlers struct {
+	handleSend     func(string) error
+	handleSendSync func(string) (string, error)
+}
+
+// ModuleStats provides the cumulative counts of a Worker's module loading.
+type ModuleStats struct {
+	// Fetched counts the module sources that had to be fetched with
+	// GetModuleSource.
+	Fetched uint64
+
+	// Compiled counts the modules that were compiled.
+	Compiled uint64
+
+	// Reused counts the imports that were satisfied by an already compiled
+	// module.
+	Reused uint64
+}
+
+// ScriptSource specifies the filename and source code of a script to be loaded
+// by LoadScripts.
+type ScriptSource struct {
+	Filename string
+	Source   string
 }
 
 // Worker represents a single JavaScript VM instance.
@@ -44,6 +161,12 @@ type Worker struct {
 	instance *instance
 	mutex    sync.Mutex
 
+	// BatchModuleFetch makes LoadModule, PrefetchModule and import()
+	// expressions load the module graph a level at a time, with concurrent
+	// calls to GetModuleSource for all of the modules within a level.
+	// GetModuleSource must then be safe for concurrent use.
+	BatchModuleFetch bool
+
 	// EnablePrint creates the debug $print function in the JavaScript global
 	// scope.
 	EnablePrint bool
@@ -51,21 +174,108 @@ type Worker struct {
 	// GetModuleSource returns the source code when given the fully qualified
 	// url of a module, or returns an error if it couldn't retrieve the source
 	// code for some reason.
+	//
+	// Module sources are cached in a process-wide store that is shared by all
+	// Workers, so GetModuleSource is only called for urls that haven't been
+	// loaded by any Worker before. Use InvalidateModuleSource when the source
+	// for a url changes.
 	GetModuleSource func(url string) (source string, err error)
 
 	// HandleSend handles messages received from js.send calls. If it is nil,
 	// then an exception will be raised to the caller.
 	HandleSend func(msg string) error
 
+	// HandleSendAsync handles messages received from $sendAsync calls within
+	// any of the Worker's contexts. It is called on its own goroutine for each
+	// message, and the Promise returned to the caller in JavaScript is
+	// resolved with its response, or rejected with an Error carrying the
+	// message of its error. If it is nil, the Promise is rejected.
+	HandleSendAsync func(msg string) (response string, err error)
+
+	// HandleSendBuffer handles buffers received from $sendBuffer calls within
+	// any of the Worker's contexts. The handler takes ownership of the Buffer
+	// and must Free it once done. If it is nil, the buffers are discarded.
+	HandleSendBuffer func(buf *Buffer)
+
+	// HandleSendJSON handles the UTF-8 encoded JSON produced by $sendJSON
+	// calls within any of the Worker's contexts, which serialize their
+	// argument natively. If it returns an error, or is nil, an exception is
+	// raised to the caller.
+	HandleSendJSON func(data []byte) error
+
 	// HandleSendSync handles messages received from js.sendSync calls. Its
 	// return value will be passed back to the caller in JavaScript. If
 	// HandleSendSync is nil, then an exception will be raised to the caller.
 	HandleSendSync func(msg string) (response string, err error)
 
+	// HandleSendValue handles values received from $sendValue calls within
+	// any of the Worker's contexts, decoded as described for DecodeValue. If
+	// it returns an error, or is nil, an exception is raised to the caller.
+	HandleSendValue func(v interface{}) error
+
+	// MaxArrayBufferBytes, if non-zero, limits the total size of the
+	// Worker's ArrayBuffers. Once it's reached, creating an ArrayBuffer or
+	// typed array raises a RangeError.
+	MaxArrayBufferBytes int
+
+	// MaxHeapBytes, if non-zero, limits the size of the old generation of the
+	// Worker's heap, which holds most long-lived objects. When a script gets
+	// close to the limit, it is terminated and the Worker fails: every later
+	// call into it returns an error, and HeapLimitReached reports true, until
+	// the Worker is Reset. The process and its other Workers are unaffected.
+	MaxHeapBytes int
+
+	// MaxStackBytes, if non-zero, limits the size of the stack used by the
+	// Worker's JavaScript. It only applies to Owned Workers, as others run
+	// on whichever thread calls them, and must be smaller than the owner
+	// thread's stack. Exceeding it raises a RangeError.
+	MaxStackBytes int
+
+	// MaxYoungGenerationBytes, if non-zero, limits the size of the young
+	// generation of the Worker's heap, where new objects are allocated.
+	MaxYoungGenerationBytes int
+
+	// Owned, if set, dedicates an OS thread to the Worker's JavaScript VM
+	// instance, which stays inside it for the lifetime of the Worker. Calls
+	// on the Worker and its Contexts are queued for that thread, instead of
+	// locking the instance and entering it from whichever thread they're made
+	// on. This makes them safe to make concurrently, including calls to
+	// LoadScript and LoadModule, and avoids migrating V8's state between
+	// threads. Terminate isn't queued, so it can still interrupt a running
+	// script.
+	Owned bool
+
 	// ResolveModuleURL resolves the url of a module relative to the module it
 	// was imported from and returns the fully qualified url of the module, or
-	// an error if no such module could be found.
+	// an error if no such module could be found. Results are memoized, so it
+	// is called at most once for each pair of url and importer within a
+	// context. If ResolveModuleURL is nil, import specifiers are used as urls
+	// as is.
 	ResolveModuleURL func(url string, importer string) (string, error)
+
+	// SendQueue, if set, makes $send calls queue their messages for delivery
+	// to HandleSend in batches on a separate goroutine.
+	SendQueue *SendQueue
+
+	// Snapshot, if set, is used to create the JavaScript VM instance. The
+	// EnablePrint setting is ignored in favour of the one the Snapshot was
+	// created with.
+	Snapshot *Snapshot
+}
+
+// ClearModuleSources empties the process-wide store of module sources.
+func ClearModuleSources() {
+	C.worker_clear_module_sources()
+}
+
+// InvalidateModuleSource removes the module with the given fully qualified url
+// from the process-wide store of module sources, so that its source is fetched
+// with GetModuleSource the next time it's loaded. Workers that have already
+// loaded the module are not affected.
+func InvalidateModuleSource(url string) {
+	urlStr := C.CString(url)
+	defer C.free(unsafe.Pointer(urlStr))
+	C.worker_invalidate_module_source(urlStr)
 }
 
 // Version returns the V8 version, e.g. "6.6.346.19".
@@ -73,6 +283,49 @@ func Version() string {
 	return C.GoString(C.worker_version())
 }
 
+// Convert the malloc'd error strings within the given C array into Go errors,
+// freeing them as we go.
+func collectErrors(errsPtr unsafe.Pointer, n int) []error {
+	errs := make([]error, n)
+	for i, err := range (*[1 << 28]*C.char)(errsPtr)[:n:n] {
+		if err != nil {
+			errs[i] = errors.New(C.GoString(err))
+			C.free(unsafe.Pointer(err))
+		}
+	}
+	return errs
+}
+
+// Initialise V8 the first time it's needed.
+func initV8() {
+	once.Do(func() {
+		C.v8_init()
+	})
+}
+
+// Pack the given messages end to end into a pooled buffer, along with their
+// lengths.
+func packBatch(msgs []string) *batchBuffer {
+	b := batchBuffers.Get().(*batchBuffer)
+	b.data = b.data[:0]
+	b.lengths = b.lengths[:0]
+	for _, msg := range msgs {
+		b.data = append(b.data, msg...)
+		b.lengths = append(b.lengths, C.int(len(msg)))
+	}
+	return b
+}
+
+// Return a pointer to the bytes of a Go string, so that C can borrow them for
+// the duration of a call without them being copied. C must not modify or
+// retain them.
+func stringData(s string) *C.char {
+	if len(s) == 0 {
+		return nil
+	}
+	return *(**C.char)(unsafe.Pointer(&s))
+}
+
 // We use this indirection to get at active instances as we can't safely pass
 // pointers to Go objects to C.
 func getInstance(id int32) *instance {
@@ -82,32 +335,122 @@ func getInstance(id int32) *instance {
 }
 
 //export getModuleSource
-func getModuleSource(id int32, url *C.char) *C.char {
+func getModuleSource(id int32, url *C.char, errp **C.char) *C.char {
 	source, err := getInstance(id).getModuleSource(C.GoString(url))
 	if err != nil {
-		panic(err)
+		*errp = C.CString("v8: couldn't get source for " + C.GoString(url) + ": " + err.Error())
+		return nil
 	}
 	return C.CString(source)
 }
 
+// Fetch the sources for the given urls concurrently, storing them in the sources
+// array. If any of the fetches fail, an error message is returned instead.
+//
+//export getModuleSources
+func getModuleSources(id int32, urls **C.char, count C.int, sources **C.char) *C.char {
+	n := int(count)
+	urlSlice := (*[1 << 28]*C.char)(unsafe.Pointer(urls))[:n:n]
+	sourceSlice := (*[1 << 28]*C.char)(unsafe.Pointer(sources))[:n:n]
+	getSource := getInstance(id).getModuleSource
+	results := make([]string, n)
+	errs := make([]error, n)
+	var wg sync.WaitGroup
+	wg.Add(n)
+	for i := 0; i < n; i++ {
+		go func(i int, url string) {
+			defer wg.Done()
+			results[i], errs[i] = getSource(url)
+		}(i, C.GoString(urlSlice[i]))
+	}
+	wg.Wait()
+	for i, err := range errs {
+		if err != nil {
+			return C.CString("v8: couldn't get source for " + C.GoString(urlSlice[i]) + ": " + err.Error())
+		}
+	}
+	for i, source := range results {
+		sourceSlice[i] = C.CString(source)
+	}
+	return nil
+}
+
+// Return the handlers for the given context of an active instance. A ctx value
+// of 0 refers to the instance's default context.
+func getHandlers(id int32, ctx int32) (func(string) error, func(string) (string, error)) {
+	return getInstance(id).handlers(ctx)
+}
+
+//export resolveModuleURL
+func resolveModuleURL(id int32, specifier *C.char, referrer *C.char, errp **C.char) *C.char {
+	url, err := getInstance(id).resolveModuleURL(C.GoString(specifier), C.GoString(referrer))
+	if err != nil {
+		*errp = C.CString(err.Error())
+		return nil
+	}
+	return C.CString(url)
+}
+
+//export readCodeCache
+func readCodeCache(key *C.char, size *C.int) unsafe.Pointer {
+	data := readCodeCacheFile(C.GoString(key))
+	if data == nil {
+		return nil
+	}
+	*size = C.int(len(data))
+	return C.CBytes(data)
+}
+
+//export writeCodeCache
+func writeCodeCache(key *C.char, data unsafe.Pointer, size C.int) {
+	writeCodeCacheFile(C.GoString(key), C.GoBytes(data, size))
+}
+
 //export recvCb
-func recvCb(id int32, msg *C.char) {
-	cb := getInstance(id).handleSend
+func recvCb(id int32, ctx int32, msg *C.char, length C.int) {
+	cb, _ := getHandlers(id, ctx)
 	if cb != nil {
-		cb(C.GoString(msg))
+		cb(C.GoStringN(msg, length))
 	}
 }
 
 //export recvSyncCb
-func recvSyncCb(id int32, msg *C.char) *C.char {
-	cb := getInstance(id).handleSendSync
-	var resp string
+func recvSyncCb(id int32, ctx int32, msg *C.char, length C.int, resp **C.char) C.int {
+	i := getInstance(id)
+	_, cb := i.handlers(ctx)
+	var r string
 	if cb == nil {
-		resp = "v8: Worker.HandleSendSync is nil"
+		r = "v8: Worker.HandleSendSync is nil"
 	} else {
-		resp, _ = cb(C.GoString(msg))
+		r, _ = cb(C.GoStringN(msg, length))
+	}
+	*resp = i.setSyncResponse(r)
+	return C.int(len(r))
+}
+
+// Return the handlers for the given context. A ctx value of 0 refers to the
+// instance's default context.
+func (i *instance) handlers(ctx int32) (func(string) error, func(string) (string, error)) {
+	if ctx == 0 {
+		return i.handleSend, i.handleSendSync
+	}
+	mutex.Lock()
+	defer mutex.Unlock()
+	c := i.contexts[ctx]
+	return c.handleSend, c.handleSendSync
+}
+
+// Copy a $sendSync response into the instance's native response buffer, which
+// is reused across calls and only grown when needed.
+func (i *instance) setSyncResponse(resp string) *C.char {
+	if len(resp) > i.syncResponseCap {
+		i.syncResponse = C.realloc(i.syncResponse, C.size_t(len(resp)))
+		i.syncResponseCap = len(resp)
+	}
+	if len(resp) > 0 {
+		copy((*[1 << 30]byte)(i.syncResponse)[:len(resp):len(resp)], resp)
 	}
-	return C.CString(resp)
+	return (*C.char)(i.syncResponse)
 }
 
 // Free resources associated with the underlying instance and V8 Isolate.
@@ -115,7 +458,19 @@ func (w *Worker) dispose() {
 	mutex.Lock()
 	delete(registry, w.instance.id)
 	mutex.Unlock()
+	// Wait for any $sendAsync requests that are being settled.
+	w.instance.settleMutex.Lock()
+	w.instance.disposed = true
+	w.instance.settleMutex.Unlock()
+	if w.instance.owner != nil {
+		w.instance.owner.stop()
+	}
 	C.worker_dispose(w.instance.worker)
+	w.instance.failAsyncCalls()
+	C.free(w.instance.syncResponse)
+	if w.instance.sendQueue != nil {
+		close(w.instance.sendQueue)
+	}
 }
 
 // Convert the last exception into a Go value.
@@ -125,6 +480,41 @@ func (w *Worker) getError() error {
 	return errors.New(C.GoString(err))
 }
 
+// Run fn with exclusive access to the Worker's JavaScript VM instance,
+// initialising it first if needed. If the Worker is Owned, fn runs on the
+// instance's owner thread, and is serialised with other calls by its queue
+// rather than by the Worker's mutex.
+func (w *Worker) runLocked(fn func()) {
+	w.mutex.Lock()
+	w.init()
+	if o := w.instance.owner; o != nil {
+		w.mutex.Unlock()
+		o.run(fn)
+		return
+	}
+	defer w.mutex.Unlock()
+	fn()
+}
+
+// Like runLocked, but without holding the Worker's mutex while fn runs, so
+// that Terminate can interrupt it. V8's Locker serialises it with other calls
+// into the instance.
+func (w *Worker) run(fn func()) {
+	w.mutex.Lock()
+	w.init()
+	i := w.instance
+	w.mutex.Unlock()
+	i.run(fn)
+}
+
+func (i *instance) run(fn func()) {
+	if i.owner != nil {
+		i.owner.run(fn)
+		return
+	}
+	fn()
+}
+
 // Initialise the underlying JavaScript VM instance.
 func (w *Worker) init() {
 	if w.instance != nil {
@@ -134,24 +524,58 @@ func (w *Worker) init() {
 	mutex.Lock()
 	nextID++
 	i := &instance{
-		getModuleSource: w.GetModuleSource,
-		handleSend:      w.HandleSend,
-		handleSendSync:  w.HandleSendSync,
-		id:              nextID,
+		asyncCalls:       map[int32]chan Result{},
+		batchModuleFetch: w.BatchModuleFetch,
+		contexts:         map[int32]contextHandlers{},
+		getModuleSource:  w.GetModuleSource,
+		handleSend:       w.HandleSend,
+		handleSendAsync:  w.HandleSendAsync,
+		handleSendBuffer: w.HandleSendBuffer,
+		handleSendJSON:   w.HandleSendJSON,
+		handleSendSync:   w.HandleSendSync,
+		handleSendValue:  w.HandleSendValue,
+		id:               nextID,
+		resolveModuleURL: w.ResolveModuleURL,
+		snapshot:         w.Snapshot,
 	}
 	registry[nextID] = i
 	mutex.Unlock()
 
-	once.Do(func() {
-		C.v8_init()
-	})
+	initV8()
 
 	var enablePrint int32
 	if w.EnablePrint {
 		enablePrint = 1
 	}
 
-	i.worker = C.worker_init(C.int(i.id), C.int(enablePrint))
+	var resolveModuleURLs int32
+	if w.ResolveModuleURL != nil {
+		resolveModuleURLs = 1
+	}
+
+	var batchModuleFetch int32
+	if w.BatchModuleFetch {
+		batchModuleFetch = 1
+	}
+
+	var snapshot *C.worker_snapshot
+	if i.snapshot != nil {
+		snapshot = &i.snapshot.snapshot
+	}
+
+	limits := C.worker_limits{
+		max_old_generation_bytes:   C.size_t(w.MaxHeapBytes),
+		max_young_generation_bytes: C.size_t(w.MaxYoungGenerationBytes),
+		max_stack_bytes:            C.size_t(w.MaxStackBytes),
+		max_array_buffer_bytes:     C.size_t(w.MaxArrayBufferBytes),
+	}
+	i.worker = C.worker_init(C.int(i.id), C.int(enablePrint), C.int(resolveModuleURLs), C.int(batchModuleFetch), snapshot, &limits)
+	if w.SendQueue != nil {
+		w.SendQueue.start(i)
+	}
+	if w.Owned {
+		i.owner = startOwner(i.worker)
+	}
 	w.instance = i
 
 	runtime.SetFinalizer(w, func(w *Worker) {
@@ -160,74 +584,330 @@ func (w *Worker) init() {
 }
 
 // LoadModule loads and executes ES Module code with the given url. LoadModule
-// is not threadsafe.
-func (w *Worker) LoadModule(url string) error {
+// is not threadsafe, unless the Worker is Owned.
+func (w *Worker) LoadModule(url string) (err error) {
+	w.run(func() {
+		if w.instance.getModuleSource == nil {
+			err = errors.New("v8: GetModuleSource needs to be set before any methods are called")
+			return
+		}
+
+		urlStr := C.CString(url)
+		defer C.free(unsafe.Pointer(urlStr))
+
+		var batch C.int
+		if w.instance.batchModuleFetch {
+			batch = 1
+		}
+		if C.worker_load_module(w.instance.worker, urlStr, batch) != 0 {
+			err = w.getError()
+		}
+	})
+	return err
+}
+
+// PrefetchModule fetches and compiles the module with the given url, along with
+// its imports, without evaluating it. It can be used to warm up modules that
+// are expected to be loaded soon with a dynamic import() or LoadModule.
+func (w *Worker) PrefetchModule(url string) (err error) {
+	w.run(func() {
+		if w.instance.getModuleSource == nil {
+			err = errors.New("v8: GetModuleSource needs to be set before any methods are called")
+			return
+		}
+
+		urlStr := C.CString(url)
+		defer C.free(unsafe.Pointer(urlStr))
+
+		if C.worker_prefetch_module(w.instance.worker, urlStr) != 0 {
+			err = w.getError()
+		}
+	})
+	return err
+}
+
+// ModuleStats returns the counts of the modules that the Worker has fetched,
+// compiled and reused.
+func (w *Worker) ModuleStats() ModuleStats {
 	w.mutex.Lock()
-	w.init()
-	if w.instance.getModuleSource == nil {
-		return errors.New("v8: GetModuleSource needs to be set before any methods are called")
-	}
+	i := w.instance
 	w.mutex.Unlock()
 
-	urlStr := C.CString(url)
-	defer C.free(unsafe.Pointer(urlStr))
-
-	r := C.worker_load_module(w.instance.worker, urlStr)
-	if r != 0 {
-		return w.getError()
+	if i == nil {
+		return ModuleStats{}
+	}
+	var stats C.worker_module_stats
+	i.run(func() {
+		C.worker_get_module_stats(i.worker, &stats)
+	})
+	return ModuleStats{
+		Fetched:  uint64(stats.fetched),
+		Compiled: uint64(stats.compiled),
+		Reused:   uint64(stats.reused),
 	}
-	return nil
 }
 
 // LoadScript loads and executes JavaScript code with the given filename and
-// source code. LoadScript is not threadsafe.
-func (w *Worker) LoadScript(filename string, source string) error {
-	w.mutex.Lock()
-	w.init()
-	w.mutex.Unlock()
-
+// source code. If EnableCodeCache has been called, the compiled code is looked
+// up in and added to the code cache. LoadScript is not threadsafe, unless the
+// Worker is Owned.
+func (w *Worker) LoadScript(filename string, source string) (err error) {
 	filenameStr := C.CString(filename)
 	sourceStr := C.CString(source)
 	defer C.free(unsafe.Pointer(filenameStr))
 	defer C.free(unsafe.Pointer(sourceStr))
 
-	r := C.worker_load_script(w.instance.worker, filenameStr, sourceStr)
-	if r != 0 {
-		return w.getError()
+	var keyStr *C.char
+	if key := codeCacheKey(source); key != "" {
+		keyStr = C.CString(key)
+		defer C.free(unsafe.Pointer(keyStr))
 	}
-	return nil
+
+	w.run(func() {
+		var r C.int
+		if keyStr != nil {
+			r = C.worker_load_script_cached(w.instance.worker, filenameStr, sourceStr, keyStr)
+		} else {
+			r = C.worker_load_script(w.instance.worker, filenameStr, sourceStr)
+		}
+		if r != 0 {
+			err = w.getError()
+		}
+	})
+	return err
 }
 
-// Send a message, calling the $recv callback in JavaScript.
-func (w *Worker) Send(msg string) error {
-	w.mutex.Lock()
-	defer w.mutex.Unlock()
+// LoadScripts loads and executes the given scripts in order. Unlike sequential
+// calls to LoadScript, the scripts are parsed and compiled concurrently on V8's
+// background threads before any of them are run. If a script fails, the
+// remaining scripts are not run. LoadScripts is not threadsafe, unless the
+// Worker is Owned.
+func (w *Worker) LoadScripts(scripts []ScriptSource) (err error) {
+	if len(scripts) == 0 {
+		w.mutex.Lock()
+		w.init()
+		w.mutex.Unlock()
+		return nil
+	}
 
-	w.init()
-	msgStr := C.CString(msg)
-	defer C.free(unsafe.Pointer(msgStr))
+	size := C.size_t(len(scripts)) * C.size_t(unsafe.Sizeof(uintptr(0)))
+	namesPtr := C.malloc(size)
+	sourcesPtr := C.malloc(size)
+	defer C.free(namesPtr)
+	defer C.free(sourcesPtr)
+
+	names := (*[1 << 28]*C.char)(namesPtr)[:len(scripts):len(scripts)]
+	sources := (*[1 << 28]*C.char)(sourcesPtr)[:len(scripts):len(scripts)]
+	for i, script := range scripts {
+		names[i] = C.CString(script.Filename)
+		sources[i] = C.CString(script.Source)
+		defer C.free(unsafe.Pointer(names[i]))
+		defer C.free(unsafe.Pointer(sources[i]))
+	}
 
-	r := C.worker_send(w.instance.worker, msgStr)
-	if r != 0 {
-		return w.getError()
+	w.run(func() {
+		var failed C.int
+		if C.worker_load_scripts(w.instance.worker, C.int(len(scripts)), (**C.char)(namesPtr), (**C.char)(sourcesPtr), &failed) != 0 {
+			err = w.getError()
+		}
+	})
+	return err
+}
+
+// LoadScriptReader is like LoadScript, but reads the UTF-8 source code from r.
+// The script is parsed on a background thread as it is being read, and the
+// full source never has to be held as a single Go string. The Worker is held
+// for the whole time, so calls on it from other goroutines block until the
+// script has been run. LoadScriptReader is not threadsafe, unless the Worker
+// is Owned.
+func (w *Worker) LoadScriptReader(filename string, r io.Reader) (err error) {
+	filenameStr := C.CString(filename)
+	defer C.free(unsafe.Pointer(filenameStr))
+
+	w.run(func() {
+		// The stream keeps the isolate locked until it's finished, and the
+		// lock must be released by the thread that took it.
+		runtime.LockOSThread()
+		defer runtime.UnlockOSThread()
+
+		stream := C.worker_load_script_stream(w.instance.worker, filenameStr)
+		// If r panics, the stream is still aborted, so that the parser thread
+		// is joined and the isolate unlocked before the panic carries on.
+		finished := false
+		defer func() {
+			if !finished {
+				C.worker_script_stream_finish(stream, 1)
+			}
+		}()
+		buf := make([]byte, 64<<10)
+		abort := C.int(0)
+		for {
+			n, rerr := r.Read(buf)
+			if n > 0 {
+				C.worker_script_stream_write(stream, (*C.char)(unsafe.Pointer(&buf[0])), C.int(n))
+			}
+			if rerr == io.EOF {
+				break
+			}
+			if rerr != nil {
+				abort, err = 1, rerr
+				break
+			}
+		}
+		finished = true
+		if C.worker_script_stream_finish(stream, abort) != 0 && abort == 0 {
+			err = w.getError()
+		}
+	})
+	// Keep the finalizer from disposing of the isolate under the parser.
+	runtime.KeepAlive(w)
+	return err
+}
+
+// Reset discards the Worker's global scope, loaded modules, and registered
+// $recv and $recvSync callbacks, and replaces them with a pristine global
+// scope. It's cheaper than creating a new Worker as the underlying JavaScript
+// VM instance is reused. If the Worker was created from a Snapshot, the global
+// scope is restored from it. A Worker that failed after reaching its
+// MaxHeapBytes limit is usable again once it has been Reset.
+func (w *Worker) Reset() {
+	w.mutex.Lock()
+	i := w.instance
+	w.mutex.Unlock()
+
+	// Don't bother if we haven't yet been initialised.
+	if i != nil {
+		w.runLocked(func() {
+			C.worker_reset(i.worker)
+		})
 	}
-	return nil
+}
+
+// Send a message, calling the $recv callback in JavaScript.
+func (w *Worker) Send(msg string) (err error) {
+	w.runLocked(func() {
+		if C.worker_send(w.instance.worker, stringData(msg), C.int(len(msg))) != 0 {
+			err = w.getError()
+		}
+	})
+	return err
 }
 
 // SendSync sends a message, calling the $recvSync callback in JavaScript. The
 // return value of that callback will be passed back to the caller in Go.
 func (w *Worker) SendSync(msg string) (string, error) {
+	var response string
+	w.runLocked(func() {
+		var resp *C.char
+		n := C.worker_send_sync(w.instance.worker, stringData(msg), C.int(len(msg)), &resp)
+		response = C.GoStringN(resp, n)
+	})
+	return response, nil
+}
+
+// SendBatch sends each of the given messages to the $recv callback in
+// JavaScript, entering the JavaScript VM only once for the whole batch. This
+// amortises the fixed cost of a Send across many small messages. If any of the
+// calls fail, the returned slice holds the error for each message, with nil
+// entries for those that succeeded. Otherwise, it is nil.
+func (w *Worker) SendBatch(msgs []string) []error {
+	if len(msgs) == 0 {
+		w.mutex.Lock()
+		w.init()
+		w.mutex.Unlock()
+		return nil
+	}
+
+	b := packBatch(msgs)
+	defer batchBuffers.Put(b)
+	errsPtr := C.malloc(C.size_t(len(msgs)) * C.size_t(unsafe.Sizeof(uintptr(0))))
+	defer C.free(errsPtr)
+
+	var failed C.int
+	w.runLocked(func() {
+		failed = C.worker_send_batch(w.instance.worker, C.int(len(msgs)), b.dataPtr(), &b.lengths[0], (**C.char)(errsPtr))
+	})
+	if failed == 0 {
+		return nil
+	}
+	return collectErrors(errsPtr, len(msgs))
+}
+
+// SendSyncBatch sends each of the given messages to the $recvSync callback in
+// JavaScript, entering the JavaScript VM only once for the whole batch, and
+// returns the response to each. If any of the calls fail, the returned error
+// slice holds the error for each message, with nil entries for those that
+// succeeded. Otherwise, it is nil.
+func (w *Worker) SendSyncBatch(msgs []string) ([]string, []error) {
+	if len(msgs) == 0 {
+		w.mutex.Lock()
+		w.init()
+		w.mutex.Unlock()
+		return nil, nil
+	}
+
+	b := packBatch(msgs)
+	defer batchBuffers.Put(b)
+	size := C.size_t(len(msgs)) * C.size_t(unsafe.Sizeof(uintptr(0)))
+	respsPtr := C.malloc(size)
+	errsPtr := C.malloc(size)
+	lengths := make([]C.int, len(msgs))
+	defer C.free(respsPtr)
+	defer C.free(errsPtr)
+
+	var failed C.int
+	w.runLocked(func() {
+		failed = C.worker_send_sync_batch(w.instance.worker, C.int(len(msgs)), b.dataPtr(), &b.lengths[0], (**C.char)(respsPtr), &lengths[0], (**C.char)(errsPtr))
+	})
+	resps := make([]string, len(msgs))
+	for i, resp := range (*[1 << 28]*C.char)(respsPtr)[:len(msgs):len(msgs)] {
+		if resp != nil {
+			resps[i] = C.GoStringN(resp, lengths[i])
+			C.free(unsafe.Pointer(resp))
+		}
+	}
+	if failed == 0 {
+		return resps, nil
+	}
+	return resps, collectErrors(errsPtr, len(msgs))
+}
+
+// ArrayBufferBytes returns the number of bytes taken up by the Worker's
+// ArrayBuffers, including the backing stores of its typed arrays and any
+// Buffers passed to it with SendBuffer that it still holds.
+func (w *Worker) ArrayBufferBytes() uint64 {
 	w.mutex.Lock()
 	defer w.mutex.Unlock()
 
-	w.init()
-	msgStr := C.CString(msg)
-	defer C.free(unsafe.Pointer(msgStr))
+	if w.instance == nil {
+		return 0
+	}
+	return uint64(C.worker_array_buffer_bytes(w.instance.worker))
+}
+
+// HeapLimitReached returns whether the Worker has failed after reaching its
+// MaxHeapBytes limit, and hasn't been Reset since.
+func (w *Worker) HeapLimitReached() bool {
+	w.mutex.Lock()
+	defer w.mutex.Unlock()
 
-	resp := C.worker_send_sync(w.instance.worker, msgStr)
-	defer C.free(unsafe.Pointer(resp))
+	return w.instance != nil && C.worker_heap_limit_reached(w.instance.worker) != 0
+}
+
+// LowMemoryNotification hints that the Worker is idle and that its JavaScript
+// VM should free as much memory as it can, e.g. by running a full garbage
+// collection.
+func (w *Worker) LowMemoryNotification() {
+	w.mutex.Lock()
+	i := w.instance
+	w.mutex.Unlock()
 
-	return C.GoString(resp), nil
+	// Don't bother if we haven't yet been initialised.
+	if i != nil {
+		i.run(func() {
+			C.worker_low_memory_notification(i.worker)
+		})
+	}
 }
 
 // Terminate instructs the underlying JavaScript VM to stop its current thread
@@ -245,7 +925,6 @@ func (w *Worker) Terminate() {
 
 // TODO:
 //
-// Configure module resolution
 // Fully fledged error values
 // Raise exceptions in JS
 // Return errors in Go
@@ -1,9 +1,20 @@
 package v8
 
 import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"path"
+	"reflect"
 	"runtime"
+	"strings"
+	"sync"
+	"sync/atomic"
 	"testing"
 	"time"
+	"unsafe"
 )
 
 func TestVersion(t *testing.T) {
@@ -12,9 +23,27 @@ func TestVersion(t *testing.T) {
 
 func DiscardSendSync(msg string) string { return "" }
 
+// newWorker creates a Worker with $print enabled and the given handlers, either
+// of which may be nil.
+func newWorker(handleSend func(string), handleSendSync func(string) string) *Worker {
+	w := &Worker{EnablePrint: true}
+	if handleSend != nil {
+		w.HandleSend = func(msg string) error {
+			handleSend(msg)
+			return nil
+		}
+	}
+	if handleSendSync != nil {
+		w.HandleSendSync = func(msg string) (string, error) {
+			return handleSendSync(msg), nil
+		}
+	}
+	return w
+}
+
 func TestBasic(t *testing.T) {
 	recvCount := 0
-	worker := New(func(msg string) {
+	worker := newWorker(func(msg string) {
 		println("recv cb", msg)
 		if msg != "hello" {
 			t.Fatal("bad msg", msg)
@@ -23,13 +52,13 @@ func TestBasic(t *testing.T) {
 	}, DiscardSendSync)
 
 	code := ` $print("ready"); `
-	err := worker.Load("code.js", code)
+	err := worker.LoadScript("code.js", code)
 	if err != nil {
 		t.Fatal(err)
 	}
 
 	codeWithSyntaxError := ` $print(hello world"); `
-	err = worker.Load("codeWithSyntaxError.js", codeWithSyntaxError)
+	err = worker.LoadScript("codeWithSyntaxError.js", codeWithSyntaxError)
 	if err == nil {
 		t.Fatal("Expected error")
 	}
@@ -41,7 +70,7 @@ func TestBasic(t *testing.T) {
 		});
 		$print("ready");
 	`
-	err = worker.Load("codeWithRecv.js", codeWithRecv)
+	err = worker.LoadScript("codeWithRecv.js", codeWithRecv)
 	if err != nil {
 		t.Fatal(err)
 	}
@@ -51,7 +80,7 @@ func TestBasic(t *testing.T) {
 		$send("hello");
 		$send("hello");
 	`
-	err = worker.Load("codeWithSend.js", codeWithSend)
+	err = worker.LoadScript("codeWithSend.js", codeWithSend)
 	if err != nil {
 		t.Fatal(err)
 	}
@@ -62,9 +91,9 @@ func TestBasic(t *testing.T) {
 }
 
 func TestUint8Array(t *testing.T) {
-	worker := New(func(msg string) {}, DiscardSendSync)
+	worker := newWorker(func(msg string) {}, DiscardSendSync)
 	codeWithArrayBufferAllocator := ` var uint8 = new Uint8Array(256); $print(uint8); `
-	err := worker.Load("buffer.js", codeWithArrayBufferAllocator)
+	err := worker.LoadScript("buffer.js", codeWithArrayBufferAllocator)
 	if err != nil {
 		t.Fatal(err)
 	}
@@ -72,21 +101,21 @@ func TestUint8Array(t *testing.T) {
 
 func TestMultipleWorkers(t *testing.T) {
 	recvCount := 0
-	worker1 := New(func(msg string) {
+	worker1 := newWorker(func(msg string) {
 		println("w1", msg)
 		recvCount++
 	}, DiscardSendSync)
-	worker2 := New(func(msg string) {
+	worker2 := newWorker(func(msg string) {
 		println("w2", msg)
 		recvCount++
 	}, DiscardSendSync)
 
-	err := worker1.Load("1.js", `$send("hello1")`)
+	err := worker1.LoadScript("1.js", `$send("hello1")`)
 	if err != nil {
 		t.Fatal(err)
 	}
 
-	err = worker2.Load("2.js", `$send("hello2")`)
+	err = worker2.LoadScript("2.js", `$send("hello2")`)
 	if err != nil {
 		t.Fatal(err)
 	}
@@ -98,7 +127,7 @@ func TestMultipleWorkers(t *testing.T) {
 
 func TestRequestFromJS(t *testing.T) {
 	var caught string
-	worker := New(func(msg string) {
+	worker := newWorker(func(msg string) {
 		println("recv cb", msg)
 		caught = msg
 	}, func(msg string) string {
@@ -109,7 +138,7 @@ func TestRequestFromJS(t *testing.T) {
 	var response = $sendSync("ping");
 	$send(response);
 `
-	err := worker.Load("code.js", code)
+	err := worker.LoadScript("code.js", code)
 	if err != nil {
 		t.Fatal(err)
 	}
@@ -119,10 +148,8 @@ func TestRequestFromJS(t *testing.T) {
 }
 
 func TestRequestFromGo(t *testing.T) {
-	var caught string
-	worker := New(func(msg string) {
+	worker := newWorker(func(msg string) {
 		println("recv cb", msg)
-		caught = msg
 	}, DiscardSendSync)
 	code := `
 	$recvSync(function(msg) {
@@ -130,18 +157,39 @@ func TestRequestFromGo(t *testing.T) {
 		return msg + " exchanged";
 	});
 `
-	err := worker.Load("code.js", code)
+	err := worker.LoadScript("code.js", code)
 	if err != nil {
 		t.Fatal(err)
 	}
-	response := worker.SendSync("pong")
+	response, _ := worker.SendSync("pong")
 	if got, want := response, "pong exchanged"; got != want {
 		t.Errorf("got %q want %q", got, want)
 	}
 }
 
+func TestSendFromRecvSync(t *testing.T) {
+	var caught string
+	w := newWorker(func(msg string) {
+		caught = msg
+	}, DiscardSendSync)
+	if err := w.LoadScript("code.js", `
+	$recvSync(function(msg) {
+		$send("in recvSync:" + msg);
+		return "";
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := w.SendSync("pong"); err != nil {
+		t.Fatal(err)
+	}
+	if got, want := caught, "in recvSync:pong"; got != want {
+		t.Errorf("got %q want %q", got, want)
+	}
+}
+
 func TestRequestFromGoReturningNonString(t *testing.T) {
-	worker := New(func(msg string) {
+	worker := newWorker(func(msg string) {
 		println("recv cb", msg)
 	}, DiscardSendSync)
 	code := `
@@ -150,11 +198,11 @@ func TestRequestFromGoReturningNonString(t *testing.T) {
 		return 42;
 	});
 `
-	err := worker.Load("code.js", code)
+	err := worker.LoadScript("code.js", code)
 	if err != nil {
 		t.Fatal(err)
 	}
-	response := worker.SendSync("pang")
+	response, _ := worker.SendSync("pang")
 	if got, want := response, "v8worker: non-string return value"; got != want {
 		t.Errorf("got %q want %q", got, want)
 	}
@@ -166,11 +214,11 @@ func TestRequestFromGoReturningNonString(t *testing.T) {
 func TestWorkerDeletion(t *testing.T) {
 	recvCount := 0
 	for i := 1; i <= 100; i++ {
-		worker := New(func(msg string) {
+		worker := newWorker(func(msg string) {
 			println("worker", msg)
 			recvCount++
 		}, DiscardSendSync)
-		err := worker.Load("1.js", `$send("hello1")`)
+		err := worker.LoadScript("1.js", `$send("hello1")`)
 		if err != nil {
 			t.Fatal(err)
 		}
@@ -184,7 +232,7 @@ func TestWorkerDeletion(t *testing.T) {
 
 // Test breaking script execution
 func TestWorkerBreaking(t *testing.T) {
-	worker := New(func(msg string) {
+	worker := newWorker(func(msg string) {
 		println("recv cb", msg)
 	}, DiscardSendSync)
 
@@ -193,7 +241,7 @@ func TestWorkerBreaking(t *testing.T) {
 		w.Terminate()
 	}(worker)
 
-	worker.Load("forever.js", ` while (true) { ; } `)
+	worker.LoadScript("forever.js", ` while (true) { ; } `)
 }
 
 func TestTightCreateLoop(t *testing.T) {
@@ -204,9 +252,9 @@ func TestTightCreateLoop(t *testing.T) {
 	println("success")
 }
 
-func runSimpleWorker(t *testing.T) {
-	w := New(nil, nil)
-	err := w.Load("mytest.js", `
+func runSimpleWorker(t testing.TB) {
+	w := newWorker(nil, nil)
+	err := w.LoadScript("mytest.js", `
 	               // Do something
 	               var something = "Simple JavaScript";
 	       `)
@@ -214,3 +262,1904 @@ func runSimpleWorker(t *testing.T) {
 		t.Fatal(err)
 	}
 }
+
+func TestSnapshot(t *testing.T) {
+	snapshot, err := NewSnapshot("bootstrap.js", `
+	var greeting = "hello";
+	$recvSync(function(msg) {
+		return greeting + " " + msg;
+	});
+`, false)
+	if err != nil {
+		t.Fatal(err)
+	}
+	w := &Worker{Snapshot: snapshot}
+	if err := w.LoadScript("code.js", `greeting = "hi";`); err != nil {
+		t.Fatal(err)
+	}
+	response, err := w.SendSync("snapshot")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if got, want := response, "hi snapshot"; got != want {
+		t.Errorf("got %q want %q", got, want)
+	}
+	if _, err := NewSnapshot("send.js", `$send("hello");`, false); err == nil {
+		t.Fatal("Expected error")
+	}
+}
+
+// bootstrapSource is a stand-in for a large bootstrap bundle.
+var bootstrapSource = func() string {
+	var b strings.Builder
+	for i := 0; i < 2000; i++ {
+		fmt.Fprintf(&b, "function handler%d(x) { return [x, %d].join(':'); }\n", i, i)
+	}
+	b.WriteString("var handlers = {};\n")
+	for i := 0; i < 2000; i++ {
+		fmt.Fprintf(&b, "handlers['h%d'] = handler%d;\n", i, i)
+	}
+	b.WriteString("$recvSync(function(msg) { return handlers[msg](msg); });\n")
+	return b.String()
+}()
+
+func BenchmarkCreateWithBootstrap(b *testing.B) {
+	for i := 0; i < b.N; i++ {
+		w := &Worker{}
+		if err := w.LoadScript("bootstrap.js", bootstrapSource); err != nil {
+			b.Fatal(err)
+		}
+		if _, err := w.SendSync("h1"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkCreateWithSnapshot(b *testing.B) {
+	snapshot, err := NewSnapshot("bootstrap.js", bootstrapSource, false)
+	if err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		w := &Worker{Snapshot: snapshot}
+		if _, err := w.SendSync("h1"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestPool(t *testing.T) {
+	pool := &Pool{
+		High:           4,
+		WarmUpFilename: "warmup.js",
+		WarmUpSource:   `$recvSync(function(msg) { return "warm " + msg; });`,
+	}
+	defer pool.Close()
+	for i := 0; i < 10; i++ {
+		w, err := pool.Get()
+		if err != nil {
+			t.Fatal(err)
+		}
+		response, err := w.SendSync("pool")
+		if err != nil {
+			t.Fatal(err)
+		}
+		if got, want := response, "warm pool"; got != want {
+			t.Errorf("got %q want %q", got, want)
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	stats := pool.Stats()
+	if stats.Hits+stats.Misses != 10 {
+		t.Fatalf("bad stats: %+v", stats)
+	}
+	if stats.Hits == 0 || stats.Refills == 0 {
+		t.Fatalf("expected the pool to be refilled: %+v", stats)
+	}
+	pool.Close()
+	if _, err := pool.Get(); err == nil {
+		t.Fatal("Expected error")
+	}
+}
+
+func TestPoolSingleWorker(t *testing.T) {
+	pool := &Pool{High: 1}
+	defer pool.Close()
+	for i := 0; i < 3; i++ {
+		if _, err := pool.Get(); err != nil {
+			t.Fatal(err)
+		}
+		// Wait for the pool to be refilled after each Get.
+		deadline := time.Now().Add(5 * time.Second)
+		for pool.Stats().Idle != 1 {
+			if time.Now().After(deadline) {
+				t.Fatalf("expected the pool to be refilled: %+v", pool.Stats())
+			}
+			time.Sleep(time.Millisecond)
+		}
+	}
+	if stats := pool.Stats(); stats.Hits == 0 {
+		t.Fatalf("expected Gets to be served from the pool: %+v", stats)
+	}
+}
+
+// Return the number of live Workers.
+func registeredWorkers() int {
+	mutex.Lock()
+	defer mutex.Unlock()
+	return len(registry)
+}
+
+func TestPoolWarmUpError(t *testing.T) {
+	before := registeredWorkers()
+	pool := &Pool{
+		High:           2,
+		WarmUpFilename: "warmup.js",
+		WarmUpSource:   `throw new Error("warm-up failed");`,
+	}
+	if _, err := pool.Get(); err == nil || !strings.Contains(err.Error(), "warm-up failed") {
+		t.Fatalf("expected the warm-up error, got %v", err)
+	}
+	pool.Close()
+	// Workers that failed to warm up are disposed of, including any that the
+	// background goroutine was creating.
+	deadline := time.Now().Add(5 * time.Second)
+	for registeredWorkers() > before {
+		if time.Now().After(deadline) {
+			t.Fatalf("got %d live Workers want at most %d", registeredWorkers(), before)
+		}
+		time.Sleep(time.Millisecond)
+	}
+}
+
+func BenchmarkCreate(b *testing.B) {
+	for i := 0; i < b.N; i++ {
+		runSimpleWorker(b)
+	}
+}
+
+func BenchmarkPoolGet(b *testing.B) {
+	pool := &Pool{High: 64}
+	defer pool.Close()
+	for i := 0; i < b.N; i++ {
+		w, err := pool.Get()
+		if err != nil {
+			b.Fatal(err)
+		}
+		if err := w.LoadScript("mytest.js", `var something = "Simple JavaScript";`); err != nil {
+			b.Fatal(err)
+		}
+	}
+	stats := pool.Stats()
+	b.ReportMetric(stats.HitRate(), "hits/op")
+	b.ReportMetric(float64(stats.RefillLatency.Nanoseconds()), "refill-ns")
+}
+
+func TestReset(t *testing.T) {
+	w := &Worker{}
+	if err := w.LoadScript("code.js", `
+	var counter = 1;
+	$recvSync(function(msg) { return msg + counter; });
+`); err != nil {
+		t.Fatal(err)
+	}
+	w.Reset()
+	response, _ := w.SendSync("reset")
+	if got, want := response, "v8worker: callback not registered with $recvSync"; got != want {
+		t.Errorf("got %q want %q", got, want)
+	}
+	if err := w.LoadScript("check.js", `
+	if (typeof counter !== "undefined") throw new Error("counter survived reset");
+	$recvSync(function(msg) { return msg + " again"; });
+`); err != nil {
+		t.Fatal(err)
+	}
+	response, _ = w.SendSync("reset")
+	if got, want := response, "reset again"; got != want {
+		t.Errorf("got %q want %q", got, want)
+	}
+}
+
+func BenchmarkReset(b *testing.B) {
+	w := &Worker{}
+	for i := 0; i < b.N; i++ {
+		if err := w.LoadScript("mytest.js", `var something = "Simple JavaScript";`); err != nil {
+			b.Fatal(err)
+		}
+		w.Reset()
+	}
+}
+
+func TestContexts(t *testing.T) {
+	w := &Worker{}
+	script, err := w.CompileScript("tenant.js", `
+	var name = "unset";
+	$recvSync(function(msg) {
+		if (msg !== "get") name = msg;
+		return name;
+	});
+`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	var sent []string
+	tenants := make([]*Context, 3)
+	for i := range tenants {
+		tenants[i] = w.NewContext(func(msg string) error {
+			sent = append(sent, msg)
+			return nil
+		}, nil)
+		defer tenants[i].Close()
+		if err := tenants[i].RunScript(script); err != nil {
+			t.Fatal(err)
+		}
+	}
+	for i, c := range tenants {
+		if _, err := c.SendSync(fmt.Sprintf("tenant%d", i)); err != nil {
+			t.Fatal(err)
+		}
+	}
+	for i, c := range tenants {
+		response, _ := c.SendSync("get")
+		if got, want := response, fmt.Sprintf("tenant%d", i); got != want {
+			t.Errorf("got %q want %q", got, want)
+		}
+	}
+	if err := tenants[0].LoadScript("send.js", `$send(name);`); err != nil {
+		t.Fatal(err)
+	}
+	if len(sent) != 1 || sent[0] != "tenant0" {
+		t.Fatalf("bad sent: %v", sent)
+	}
+	if err := w.LoadScript("default.js", `
+	if (typeof name !== "undefined") throw new Error("tenant global leaked");
+`); err != nil {
+		t.Fatal(err)
+	}
+	if err := tenants[1].LoadScript("alloc.js", `var big = new Array(100000).fill("x");`); err != nil {
+		t.Fatal(err)
+	}
+	if tenants[1].AllocatedBytes() <= tenants[2].AllocatedBytes() {
+		t.Errorf("expected tenant1 to be attributed more memory than tenant2")
+	}
+}
+
+func TestCodeCache(t *testing.T) {
+	dir, err := ioutil.TempDir("", "v8-code-cache")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	if err := EnableCodeCache(dir, 1<<20); err != nil {
+		t.Fatal(err)
+	}
+	source := `function cached() { return "cached"; } cached();`
+	before := GetCodeCacheStats()
+	for i := 0; i < 3; i++ {
+		w := &Worker{}
+		if err := w.LoadScript("cached.js", source); err != nil {
+			t.Fatal(err)
+		}
+	}
+	stats := GetCodeCacheStats()
+	if got, want := stats.Misses-before.Misses, uint64(1); got != want {
+		t.Errorf("got %d misses want %d", got, want)
+	}
+	if got, want := stats.MemoryHits-before.MemoryHits, uint64(2); got != want {
+		t.Errorf("got %d memory hits want %d", got, want)
+	}
+	files, err := ioutil.ReadDir(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(files) != 1 {
+		t.Errorf("expected 1 file in the disk cache, got %d", len(files))
+	}
+}
+
+func TestModuleSourceStore(t *testing.T) {
+	sources := map[string]string{
+		"store/main.js": `import { value } from "store/dep.js"; $sendSync(value);`,
+		"store/dep.js":  `export const value = "dep";`,
+	}
+	fetched := map[string]int{}
+	newModuleWorker := func() *Worker {
+		return &Worker{
+			GetModuleSource: func(url string) (string, error) {
+				fetched[url]++
+				return sources[url], nil
+			},
+			HandleSendSync: func(msg string) (string, error) {
+				return "", nil
+			},
+		}
+	}
+	for i := 0; i < 3; i++ {
+		if err := newModuleWorker().LoadModule("store/main.js"); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if fetched["store/main.js"] != 1 || fetched["store/dep.js"] != 1 {
+		t.Fatalf("expected each module to be fetched once: %v", fetched)
+	}
+	InvalidateModuleSource("store/dep.js")
+	if err := newModuleWorker().LoadModule("store/main.js"); err != nil {
+		t.Fatal(err)
+	}
+	if fetched["store/main.js"] != 1 || fetched["store/dep.js"] != 2 {
+		t.Fatalf("expected only the invalidated module to be refetched: %v", fetched)
+	}
+}
+
+func TestLoadScriptReader(t *testing.T) {
+	var caught string
+	w := &Worker{
+		HandleSend: func(msg string) error {
+			caught = msg
+			return nil
+		},
+	}
+	source := bootstrapSource + `$send(handlers["h1999"]("é"));`
+	if err := w.LoadScriptReader("stream.js", strings.NewReader(source)); err != nil {
+		t.Fatal(err)
+	}
+	if got, want := caught, "é:1999"; got != want {
+		t.Errorf("got %q want %q", got, want)
+	}
+	if err := w.LoadScriptReader("bad.js", strings.NewReader(`$send(hello world");`)); err == nil {
+		t.Fatal("Expected error")
+	}
+}
+
+// panicReader returns part of a script and then panics.
+type panicReader struct {
+	read bool
+}
+
+func (r *panicReader) Read(p []byte) (int, error) {
+	if r.read {
+		panic("read failed")
+	}
+	r.read = true
+	return copy(p, "var x = "), nil
+}
+
+func TestLoadScriptReaderPanic(t *testing.T) {
+	for _, owned := range []bool{false, true} {
+		w := &Worker{Owned: owned}
+		func() {
+			defer func() {
+				if recover() == nil {
+					t.Fatal("expected the reader's panic to be passed on")
+				}
+			}()
+			w.LoadScriptReader("panic.js", &panicReader{})
+		}()
+		// The Worker must have been released, including by the thread that
+		// locked it, so that calls from elsewhere still go through.
+		done := make(chan error, 1)
+		go func() {
+			done <- w.LoadScript("after.js", `1 + 1;`)
+		}()
+		select {
+		case err := <-done:
+			if err != nil {
+				t.Fatal(err)
+			}
+		case <-time.After(5 * time.Second):
+			t.Fatalf("Worker (owned: %v) is still held after a panicking reader", owned)
+		}
+	}
+}
+
+func BenchmarkLoadScript(b *testing.B) {
+	source := []byte(bootstrapSource)
+	for i := 0; i < b.N; i++ {
+		w := &Worker{}
+		var buf bytes.Buffer
+		buf.Write(source)
+		if err := w.LoadScript("bootstrap.js", buf.String()); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkLoadScriptReader(b *testing.B) {
+	source := []byte(bootstrapSource)
+	for i := 0; i < b.N; i++ {
+		w := &Worker{}
+		if err := w.LoadScriptReader("bootstrap.js", bytes.NewReader(source)); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// deployScripts is a stand-in for a set of independent scripts that are
+// activated together at deploy time.
+var deployScripts = func() []ScriptSource {
+	scripts := make([]ScriptSource, 24)
+	for i := range scripts {
+		var b strings.Builder
+		for j := 0; j < 500; j++ {
+			fmt.Fprintf(&b, "function s%d_f%d(x) { return [x, %d, %d].join(':'); }\n", i, j, i, j)
+		}
+		fmt.Fprintf(&b, "var s%d = s%d_f0(%d);\n", i, i, i)
+		scripts[i] = ScriptSource{fmt.Sprintf("s%d.js", i), b.String()}
+	}
+	return scripts
+}()
+
+func TestLoadScripts(t *testing.T) {
+	w := &Worker{}
+	scripts := append(deployScripts, ScriptSource{"check.js", `
+	if (s0 !== "0:0:0" || s23 !== "23:23:0") throw new Error("scripts not run in order");
+`})
+	if err := w.LoadScripts(scripts); err != nil {
+		t.Fatal(err)
+	}
+	err := w.LoadScripts([]ScriptSource{
+		{"ok.js", `var ok = true;`},
+		{"bad.js", `$print(hello world");`},
+		{"never.js", `throw new Error("should not run");`},
+	})
+	if err == nil || !strings.Contains(err.Error(), "bad.js") {
+		t.Fatalf("expected error from bad.js, got %v", err)
+	}
+}
+
+func BenchmarkLoadScriptsSequential(b *testing.B) {
+	for i := 0; i < b.N; i++ {
+		w := &Worker{}
+		for _, script := range deployScripts {
+			if err := w.LoadScript(script.Filename, script.Source); err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+}
+
+func BenchmarkLoadScriptsBatch(b *testing.B) {
+	for i := 0; i < b.N; i++ {
+		w := &Worker{}
+		if err := w.LoadScripts(deployScripts); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// wideModuleGraph returns the sources for a module graph where a root module
+// imports width modules, each of which imports a shared leaf module.
+func wideModuleGraph(prefix string, width int) map[string]string {
+	sources := map[string]string{}
+	var root strings.Builder
+	for i := 0; i < width; i++ {
+		url := fmt.Sprintf("%s/m%d.js", prefix, i)
+		fmt.Fprintf(&root, "import { v as v%d } from %q;\n", i, url)
+		sources[url] = fmt.Sprintf("import { leaf } from %q; export const v = leaf + %d;", prefix+"/leaf.js", i)
+	}
+	sources[prefix+"/leaf.js"] = "export const leaf = 1;"
+	sources[prefix+"/root.js"] = root.String()
+	return sources
+}
+
+func TestBatchModuleFetch(t *testing.T) {
+	sources := wideModuleGraph("batch", 10)
+	var mu sync.Mutex
+	fetched := 0
+	w := &Worker{
+		BatchModuleFetch: true,
+		GetModuleSource: func(url string) (string, error) {
+			mu.Lock()
+			fetched++
+			mu.Unlock()
+			source, ok := sources[url]
+			if !ok {
+				return "", fmt.Errorf("not found")
+			}
+			return source, nil
+		},
+	}
+	if err := w.LoadModule("batch/root.js"); err != nil {
+		t.Fatal(err)
+	}
+	if got, want := fetched, len(sources); got != want {
+		t.Errorf("got %d fetches want %d", got, want)
+	}
+	sources["batch/missing.js"] = `import "batch/nowhere.js";`
+	if err := w.LoadModule("batch/missing.js"); err == nil {
+		t.Fatal("Expected error")
+	}
+}
+
+func benchmarkWideModuleGraph(b *testing.B, batch bool) {
+	sources := wideModuleGraph("wide", 50)
+	for i := 0; i < b.N; i++ {
+		ClearModuleSources()
+		w := &Worker{
+			BatchModuleFetch: batch,
+			GetModuleSource: func(url string) (string, error) {
+				// Simulate the latency of a local disk or cache sidecar.
+				time.Sleep(time.Millisecond)
+				return sources[url], nil
+			},
+		}
+		if err := w.LoadModule("wide/root.js"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkLoadModuleWide(b *testing.B) {
+	benchmarkWideModuleGraph(b, false)
+}
+
+func BenchmarkLoadModuleWideBatched(b *testing.B) {
+	benchmarkWideModuleGraph(b, true)
+}
+
+func TestLoadModuleDeduplicates(t *testing.T) {
+	sources := wideModuleGraph("dedupe", 10)
+	// Add a cycle between the leaf module and the first module.
+	sources["dedupe/leaf.js"] = `import "dedupe/m0.js"; export const leaf = 1;`
+	w := &Worker{
+		GetModuleSource: func(url string) (string, error) {
+			return sources[url], nil
+		},
+	}
+	if err := w.LoadModule("dedupe/root.js"); err != nil {
+		t.Fatal(err)
+	}
+	stats := w.ModuleStats()
+	if got, want := stats.Compiled, uint64(len(sources)); got != want {
+		t.Errorf("got %d compiled modules want %d", got, want)
+	}
+	// 9 repeated imports of the leaf module and 1 of m0 from the cycle.
+	if got, want := stats.Reused, uint64(10); got != want {
+		t.Errorf("got %d reused modules want %d", got, want)
+	}
+	if err := w.LoadModule("dedupe/m1.js"); err != nil {
+		t.Fatal(err)
+	}
+	if got, want := w.ModuleStats().Compiled, stats.Compiled; got != want {
+		t.Errorf("got %d compiled modules want %d", got, want)
+	}
+}
+
+func BenchmarkLoadModuleDiamond(b *testing.B) {
+	sources := wideModuleGraph("diamond", 200)
+	for i := 0; i < b.N; i++ {
+		w := &Worker{
+			GetModuleSource: func(url string) (string, error) {
+				return sources[url], nil
+			},
+		}
+		if err := w.LoadModule("diamond/root.js"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestResolveModuleURL(t *testing.T) {
+	sources := map[string]string{
+		"resolve/a/main.js":  `import { a } from "./util.js"; import { b } from "../b/index.js"; $sendSync(a + b);`,
+		"resolve/a/util.js":  `export const a = "a";`,
+		"resolve/b/index.js": `import { b } from "./util.js"; import { a } from "../a/util.js"; export { b };`,
+		"resolve/b/util.js":  `export const b = "b";`,
+	}
+	var caught string
+	resolved := 0
+	w := &Worker{
+		GetModuleSource: func(url string) (string, error) {
+			source, ok := sources[url]
+			if !ok {
+				return "", fmt.Errorf("not found")
+			}
+			return source, nil
+		},
+		HandleSendSync: func(msg string) (string, error) {
+			caught = msg
+			return "", nil
+		},
+		ResolveModuleURL: func(url string, importer string) (string, error) {
+			resolved++
+			return path.Join(path.Dir(importer), url), nil
+		},
+	}
+	if err := w.LoadModule("resolve/a/main.js"); err != nil {
+		t.Fatal(err)
+	}
+	if got, want := caught, "ab"; got != want {
+		t.Errorf("got %q want %q", got, want)
+	}
+	// Each of the four import statements is resolved once, even though V8
+	// resolves them again when instantiating the module graph.
+	if got, want := resolved, 4; got != want {
+		t.Errorf("got %d resolutions want %d", got, want)
+	}
+}
+
+func TestDynamicImport(t *testing.T) {
+	sources := map[string]string{
+		"lazy/handler.js": `import { prefix } from "lazy/util.js"; export function handle(msg) { return prefix + msg; }`,
+		"lazy/util.js":    `export const prefix = "lazy:";`,
+	}
+	var caught []string
+	w := &Worker{
+		GetModuleSource: func(url string) (string, error) {
+			source, ok := sources[url]
+			if !ok {
+				return "", fmt.Errorf("not found")
+			}
+			return source, nil
+		},
+		HandleSend: func(msg string) error {
+			caught = append(caught, msg)
+			return nil
+		},
+	}
+	if err := w.PrefetchModule("lazy/handler.js"); err != nil {
+		t.Fatal(err)
+	}
+	compiled := w.ModuleStats().Compiled
+	if err := w.LoadScript("main.js", `
+	import("lazy/handler.js").then(function(m) { $send(m.handle("hello")); });
+	import("lazy/missing.js").catch(function(err) { $send("error"); });
+`); err != nil {
+		t.Fatal(err)
+	}
+	if len(caught) != 2 || caught[0] != "lazy:hello" || caught[1] != "error" {
+		t.Fatalf("bad messages: %v", caught)
+	}
+	if got, want := w.ModuleStats().Compiled, compiled; got != want {
+		t.Errorf("expected prefetched modules to be reused: got %d compiled want %d", got, want)
+	}
+}
+
+func TestDynamicImportOrder(t *testing.T) {
+	var caught []string
+	w := &Worker{
+		GetModuleSource: func(url string) (string, error) {
+			return `$send("evaluated");`, nil
+		},
+		HandleSend: func(msg string) error {
+			caught = append(caught, msg)
+			return nil
+		},
+	}
+	if err := w.LoadScript("main.js", `
+	var p = import("order/side.js");
+	$send("sync");
+	p.then(function() { $send("resolved"); });
+`); err != nil {
+		t.Fatal(err)
+	}
+	// The module is only evaluated once the statement with the import() and
+	// the rest of the script have run.
+	if want := []string{"sync", "evaluated", "resolved"}; !reflect.DeepEqual(caught, want) {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+}
+
+func TestBatchDynamicImport(t *testing.T) {
+	sources := wideModuleGraph("lazybatch", 10)
+	for url, source := range wideModuleGraph("prefetchbatch", 10) {
+		sources[url] = source
+	}
+	var mu sync.Mutex
+	inflight, peak := 0, 0
+	var caught []string
+	w := &Worker{
+		BatchModuleFetch: true,
+		GetModuleSource: func(url string) (string, error) {
+			mu.Lock()
+			inflight++
+			if inflight > peak {
+				peak = inflight
+			}
+			mu.Unlock()
+			time.Sleep(time.Millisecond)
+			mu.Lock()
+			inflight--
+			mu.Unlock()
+			return sources[url], nil
+		},
+		HandleSend: func(msg string) error {
+			caught = append(caught, msg)
+			return nil
+		},
+	}
+	if err := w.PrefetchModule("prefetchbatch/root.js"); err != nil {
+		t.Fatal(err)
+	}
+	if peak < 2 {
+		t.Errorf("expected PrefetchModule to fetch the modules within a level concurrently")
+	}
+	peak = 0
+	if err := w.LoadScript("main.js", `
+	import("lazybatch/root.js").then(function() { $send("loaded"); });
+`); err != nil {
+		t.Fatal(err)
+	}
+	if len(caught) != 1 || caught[0] != "loaded" {
+		t.Fatalf("bad messages: %v", caught)
+	}
+	if peak < 2 {
+		t.Errorf("expected the modules within a level to be fetched concurrently")
+	}
+}
+
+func TestSendBuffer(t *testing.T) {
+	var received []byte
+	w := &Worker{
+		HandleSendBuffer: func(buf *Buffer) {
+			received = append([]byte(nil), buf.Bytes()...)
+			buf.Free()
+		},
+		HandleSendSync: func(msg string) (string, error) {
+			return "", nil
+		},
+	}
+	if err := w.LoadScript("buffer.js", `
+	var last;
+	$recv(function(buf) {
+		var bytes = new Uint8Array(buf);
+		for (var i = 0; i < bytes.length; i++) {
+			bytes[i] += 1;
+		}
+		last = bytes;
+		$sendBuffer(bytes.subarray(1, 3));
+		$sendSync(String(last.byteLength));
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	buf := NewBuffer(4)
+	copy(buf.Bytes(), []byte{1, 2, 3, 4})
+	if err := w.SendBuffer(buf); err != nil {
+		t.Fatal(err)
+	}
+	if !bytes.Equal(received, []byte{3, 4}) {
+		t.Fatalf("bad buffer: %v", received)
+	}
+	if err := w.SendBuffer(buf); err != errBufferReleased {
+		t.Fatalf("expected error on reusing a sent Buffer, got %v", err)
+	}
+	if err := w.LoadScript("detached.js", `
+	if (last.byteLength !== 0) {
+		throw new Error("expected sent buffer to be detached");
+	}
+`); err != nil {
+		t.Fatal(err)
+	}
+	if err := w.LoadScript("invalid.js", `$sendBuffer("not a buffer");`); err == nil {
+		t.Fatal("expected a TypeError for non-buffer values")
+	}
+}
+
+const benchmarkBufferSize = 64 << 10
+
+func BenchmarkSendString64K(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(msg) {});`); err != nil {
+		b.Fatal(err)
+	}
+	msg := strings.Repeat("x", benchmarkBufferSize)
+	b.SetBytes(benchmarkBufferSize)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := w.Send(msg); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkSendBuffer64K(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(buf) {});`); err != nil {
+		b.Fatal(err)
+	}
+	b.SetBytes(benchmarkBufferSize)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := w.SendBuffer(NewBuffer(benchmarkBufferSize)); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestSendBatch(t *testing.T) {
+	var caught []string
+	w := newWorker(func(msg string) {
+		caught = append(caught, msg)
+	}, nil)
+	if err := w.LoadScript("batch.js", `
+	$recv(function(msg) {
+		if (msg === "bad") {
+			throw new Error("bad message");
+		}
+		$send(msg.toUpperCase());
+	});
+	$recvSync(function(msg) {
+		if (msg === "bad") {
+			throw new Error("bad message");
+		}
+		return msg + "!";
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	errs := w.SendBatch([]string{"a", "bad", "c"})
+	if len(errs) != 3 || errs[0] != nil || errs[1] == nil || errs[2] != nil {
+		t.Fatalf("bad errors: %v", errs)
+	}
+	if strings.Join(caught, ",") != "A,C" {
+		t.Fatalf("bad messages: %v", caught)
+	}
+	if errs := w.SendBatch([]string{"d", "e"}); errs != nil {
+		t.Fatalf("unexpected errors: %v", errs)
+	}
+	resps, errs := w.SendSyncBatch([]string{"x", "bad", "z"})
+	if len(errs) != 3 || errs[0] != nil || errs[1] == nil || errs[2] != nil {
+		t.Fatalf("bad errors: %v", errs)
+	}
+	if strings.Join(resps, ",") != "x!,,z!" {
+		t.Fatalf("bad responses: %v", resps)
+	}
+}
+
+func benchmarkSendBatch(b *testing.B, size int) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(msg) {});`); err != nil {
+		b.Fatal(err)
+	}
+	msgs := make([]string, size)
+	for i := range msgs {
+		msgs[i] = strings.Repeat("x", 200)
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i += size {
+		if errs := w.SendBatch(msgs); errs != nil {
+			b.Fatal(errs)
+		}
+	}
+}
+
+func BenchmarkSendUnbatched(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(msg) {});`); err != nil {
+		b.Fatal(err)
+	}
+	msg := strings.Repeat("x", 200)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := w.Send(msg); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkSendBatch1(b *testing.B)   { benchmarkSendBatch(b, 1) }
+func BenchmarkSendBatch8(b *testing.B)   { benchmarkSendBatch(b, 8) }
+func BenchmarkSendBatch64(b *testing.B)  { benchmarkSendBatch(b, 64) }
+func BenchmarkSendBatch512(b *testing.B) { benchmarkSendBatch(b, 512) }
+
+func TestSendQueue(t *testing.T) {
+	const count = 1000
+	received := make(chan string, count)
+	w := &Worker{
+		HandleSend: func(msg string) error {
+			received <- msg
+			return nil
+		},
+		SendQueue: &SendQueue{FlushSize: 64},
+	}
+	if err := w.LoadScript("events.js", fmt.Sprintf(`
+	for (var i = 0; i < %d; i++) {
+		$send("event " + i);
+	}
+`, count)); err != nil {
+		t.Fatal(err)
+	}
+	timeout := time.After(5 * time.Second)
+	for i := 0; i < count; i++ {
+		select {
+		case msg := <-received:
+			if want := fmt.Sprintf("event %d", i); msg != want {
+				t.Fatalf("got %q want %q", msg, want)
+			}
+		case <-timeout:
+			t.Fatalf("timed out after receiving %d messages", i)
+		}
+	}
+}
+
+func benchmarkSendEvents(b *testing.B, queue *SendQueue) {
+	var wg sync.WaitGroup
+	w := &Worker{
+		HandleSend: func(msg string) error {
+			wg.Done()
+			return nil
+		},
+		SendQueue: queue,
+	}
+	if err := w.LoadScript("events.js", `
+	$recv(function(msg) {
+		for (var i = 0; i < 100; i++) {
+			$send("event");
+		}
+	});
+`); err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i += 100 {
+		wg.Add(100)
+		if err := w.Send("emit"); err != nil {
+			b.Fatal(err)
+		}
+	}
+	wg.Wait()
+}
+
+func BenchmarkSendEventsDirect(b *testing.B) {
+	benchmarkSendEvents(b, nil)
+}
+
+func BenchmarkSendEventsQueued(b *testing.B) {
+	benchmarkSendEvents(b, &SendQueue{})
+}
+
+func TestSendNULBytes(t *testing.T) {
+	var caught string
+	w := newWorker(func(msg string) {
+		caught = msg
+	}, func(msg string) string {
+		return msg + "\x00!"
+	})
+	if err := w.LoadScript("nul.js", `
+	var resp = $sendSync("a\0b");
+	$send(resp + resp.length);
+`); err != nil {
+		t.Fatal(err)
+	}
+	if want := "a\x00b\x00!5"; caught != want {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+	if err := w.LoadScript("nul_recv.js", `
+	$recvSync(function(msg) {
+		return msg + "\0" + msg.length;
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	resp, err := w.SendSync("x\x00y")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if want := "x\x00y\x003"; resp != want {
+		t.Fatalf("got %q want %q", resp, want)
+	}
+	resps, errs := w.SendSyncBatch([]string{"\x00", "a\x00"})
+	if errs != nil {
+		t.Fatal(errs)
+	}
+	if want := []string{"\x00\x001", "a\x00\x002"}; !reflect.DeepEqual(resps, want) {
+		t.Fatalf("got %q want %q", resps, want)
+	}
+}
+
+func BenchmarkSendSyncCallback(b *testing.B) {
+	w := newWorker(nil, func(msg string) string {
+		return msg
+	})
+	if err := w.LoadScript("callback.js", `
+	var msg = "` + strings.Repeat("x", 200) + `";
+	$recv(function(n) {
+		for (var i = 0; i < 100; i++) {
+			$sendSync(msg);
+		}
+	});
+`); err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i += 100 {
+		if err := w.Send("go"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// The SendSync benchmarks go through worker_send_sync for responses of
+// various sizes. Like BenchmarkSendSyncCallback, they only use APIs that
+// predate responses being returned as (pointer, length) pairs, so the old and
+// new paths can be compared by running them at both revisions with benchstat.
+func benchmarkSendSync(b *testing.B, size int) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("echo.js", `
+	var resp = "`+strings.Repeat("x", size)+`";
+	$recvSync(function(msg) {
+		return resp;
+	});
+`); err != nil {
+		b.Fatal(err)
+	}
+	b.SetBytes(int64(size))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := w.SendSync("go"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkSendSync16(b *testing.B) {
+	benchmarkSendSync(b, 16)
+}
+
+func BenchmarkSendSync4K(b *testing.B) {
+	benchmarkSendSync(b, 4<<10)
+}
+
+func BenchmarkSendSync64K(b *testing.B) {
+	benchmarkSendSync(b, 64<<10)
+}
+
+func TestSendLargeMessages(t *testing.T) {
+	var caught string
+	w := newWorker(func(msg string) {
+		caught = msg
+	}, func(msg string) string {
+		return msg
+	})
+	if err := w.LoadScript("echo.js", `
+	$recv(function(msg) {
+		$send(msg.length + ":" + msg);
+	});
+	$recvSync(function(msg) {
+		return msg.length + ":" + msg;
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	for _, unit := range []string{"a", "é", "€"} {
+		msg := strings.Repeat(unit, 4096)
+		want := "4096:" + msg
+		if err := w.Send(msg); err != nil {
+			t.Fatal(err)
+		}
+		if caught != want {
+			t.Errorf("bad echo of %q message from Send", unit)
+		}
+		resp, err := w.SendSync(msg)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if resp != want {
+			t.Errorf("bad echo of %q message from SendSync", unit)
+		}
+	}
+}
+
+func BenchmarkSendLargeMessage(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(msg) {});`); err != nil {
+		b.Fatal(err)
+	}
+	msg := strings.Repeat("timestamp=1530000000 level=info msg=ok\n", 1<<14)
+	b.SetBytes(int64(len(msg)))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := w.Send(msg); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestValueCodec(t *testing.T) {
+	date := time.Date(2018, 6, 1, 12, 30, 0, 250e6, time.UTC)
+	in := map[string]interface{}{
+		"array":   []interface{}{1.0, "two", nil, Undefined{}, true},
+		"bytes":   []byte{1, 2, 3},
+		"date":    date,
+		"floats":  []float64{0.5, -1},
+		"ints":    []int32{-7, 1 << 20},
+		"latin1":  "café",
+		"map":     &Map{Entries: []MapEntry{{1.0, "one"}, {"k", []interface{}{}}}},
+		"nested":  map[string]interface{}{"x": -123456.0},
+		"set":     &Set{Values: []interface{}{"a", 2.0}},
+		"unicode": "日本語 ✓",
+	}
+	data, err := EncodeValue(in)
+	if err != nil {
+		t.Fatal(err)
+	}
+	out, err := DecodeValue(data)
+	if err != nil {
+		t.Fatal(err)
+	}
+	got := out.(map[string]interface{})
+	if !got["date"].(time.Time).Equal(date) {
+		t.Errorf("bad date: got %v want %v", got["date"], date)
+	}
+	delete(got, "date")
+	delete(in, "date")
+	if !reflect.DeepEqual(got, in) {
+		t.Errorf("bad round trip:\ngot  %#v\nwant %#v", got, in)
+	}
+}
+
+func TestSendValue(t *testing.T) {
+	var caught interface{}
+	w := &Worker{
+		HandleSendValue: func(v interface{}) error {
+			caught = v
+			return nil
+		},
+	}
+	if err := w.LoadScript("values.js", `
+	$recv(function(v) {
+		if (!(v.when instanceof Date) || !(v.data instanceof Float64Array) || !(v.tags instanceof Set)) {
+			throw new Error("bad value types");
+		}
+		var m = new Map();
+		m.set("sum", v.data.reduce(function(a, b) { return a + b; }, 0));
+		m.set("year", v.when.getUTCFullYear());
+		var shared = new Uint8Array([9, 8, 7]);
+		$sendValue({stats: m, tags: Array.from(v.tags), a: shared, b: shared, u: undefined});
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	err := w.SendValue(map[string]interface{}{
+		"data": []float64{1.5, 2.5, 3},
+		"tags": &Set{Values: []interface{}{"x", "y"}},
+		"when": time.Date(2018, 6, 1, 0, 0, 0, 0, time.UTC),
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	want := map[string]interface{}{
+		"stats": &Map{Entries: []MapEntry{{"sum", 7.0}, {"year", 2018.0}}},
+		"tags":  []interface{}{"x", "y"},
+		"a":     []byte{9, 8, 7},
+		"b":     []byte{9, 8, 7},
+		"u":     Undefined{},
+	}
+	if !reflect.DeepEqual(caught, want) {
+		t.Fatalf("bad value:\ngot  %#v\nwant %#v", caught, want)
+	}
+	if err := w.LoadScript("clone.js", `$sendValue(function() {});`); err == nil {
+		t.Fatal("expected an error when sending an uncloneable value")
+	}
+}
+
+func TestSendValueSharedBuffers(t *testing.T) {
+	var caught []interface{}
+	w := &Worker{
+		HandleSendValue: func(v interface{}) error {
+			caught = append(caught, v)
+			return nil
+		},
+	}
+	// Views after the first on a buffer are written as a reference to the
+	// buffer followed by the view.
+	if err := w.LoadScript("shared.js", `
+	var buf = new ArrayBuffer(4);
+	new Uint8Array(buf).set([1, 2, 3, 4]);
+	$sendValue([new Uint8Array(buf), new Uint16Array(buf)]);
+	$sendValue([buf, new Uint8Array(buf)]);
+	$sendValue([new Uint8Array(buf, 0, 2), new DataView(buf, 2)]);
+`); err != nil {
+		t.Fatal(err)
+	}
+	want := []interface{}{
+		[]interface{}{[]byte{1, 2, 3, 4}, []uint16{0x0201, 0x0403}},
+		[]interface{}{ArrayBuffer{1, 2, 3, 4}, []byte{1, 2, 3, 4}},
+		[]interface{}{[]byte{1, 2}, []byte{3, 4}},
+	}
+	if !reflect.DeepEqual(caught, want) {
+		t.Fatalf("bad values:\ngot  %#v\nwant %#v", caught, want)
+	}
+	// The buffer and its Uint8Array view share their memory, as in JavaScript.
+	pair := caught[1].([]interface{})
+	pair[0].(ArrayBuffer)[0] = 9
+	if got := pair[1].([]byte)[0]; got != 9 {
+		t.Errorf("expected the view to share the buffer's memory, got %d", got)
+	}
+	// Send the decoded views back and check them in JavaScript.
+	if err := w.LoadScript("check.js", `
+	$recv(function(v) {
+		if (!(v[0] instanceof Uint8Array) || v[0].join() !== "1,2,3,4" ||
+			!(v[1] instanceof Uint16Array) || v[1].join() !== "513,1027") {
+			throw new Error("bad views: " + v);
+		}
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	if err := w.SendValue(caught[0]); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestDecodeValueViewAfterReference(t *testing.T) {
+	// [buf, Uint16Array(buf)] as written by V8: a dense array holding an
+	// ArrayBuffer, then a reference to it followed by a view.
+	data := []byte{
+		tagVersion, 13,
+		tagBeginDenseArray, 2,
+		tagArrayBuffer, 4, 1, 2, 3, 4,
+		tagObjectReference, 1, tagArrayBufferView, viewUint16, 0, 4,
+		tagEndDenseArray, 0, 2,
+	}
+	v, err := DecodeValue(data)
+	if err != nil {
+		t.Fatal(err)
+	}
+	want := []interface{}{ArrayBuffer{1, 2, 3, 4}, []uint16{0x0201, 0x0403}}
+	if !reflect.DeepEqual(v, want) {
+		t.Fatalf("bad value:\ngot  %#v\nwant %#v", v, want)
+	}
+}
+
+func benchmarkStructuredMessage() map[string]interface{} {
+	samples := make([]float64, 256)
+	for i := range samples {
+		samples[i] = float64(i) / 3
+	}
+	return map[string]interface{}{
+		"id":      12345.0,
+		"name":    "sensor-7",
+		"samples": samples,
+		"tags":    []interface{}{"a", "b", "c"},
+	}
+}
+
+func BenchmarkSendValue(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(v) {});`); err != nil {
+		b.Fatal(err)
+	}
+	msg := benchmarkStructuredMessage()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := w.SendValue(msg); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkSendJSON(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(msg) { JSON.parse(msg); });`); err != nil {
+		b.Fatal(err)
+	}
+	msg := benchmarkStructuredMessage()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		data, err := json.Marshal(msg)
+		if err != nil {
+			b.Fatal(err)
+		}
+		if err := w.Send(string(data)); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkSendJSONNative(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(v) {});`); err != nil {
+		b.Fatal(err)
+	}
+	msg := benchmarkStructuredMessage()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		data, err := json.Marshal(msg)
+		if err != nil {
+			b.Fatal(err)
+		}
+		if err := w.SendJSON(data); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestSendJSON(t *testing.T) {
+	var caught map[string]interface{}
+	w := &Worker{
+		HandleSendJSON: func(data []byte) error {
+			return json.Unmarshal(data, &caught)
+		},
+	}
+	if err := w.LoadScript("json.js", `
+	$recv(function(v) {
+		if (typeof v !== "object" || !Array.isArray(v.items)) {
+			throw new Error("expected a parsed object");
+		}
+		$sendJSON({count: v.items.length, name: v.name + "\u00e9"});
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	if err := w.SendJSON([]byte(`{"items": [1, 2, 3], "name": "caf"}`)); err != nil {
+		t.Fatal(err)
+	}
+	want := map[string]interface{}{"count": 3.0, "name": "caf\u00e9"}
+	if !reflect.DeepEqual(caught, want) {
+		t.Fatalf("bad value: got %#v, want %#v", caught, want)
+	}
+
+	err := w.SendJSON([]byte(`{"items": }`))
+	jsonErr, ok := err.(*JSONError)
+	if !ok {
+		t.Fatalf("expected a *JSONError, got %#v", err)
+	}
+	if jsonErr.Offset != 10 {
+		t.Fatalf("expected the error to be at offset 10, got %d: %s", jsonErr.Offset, jsonErr)
+	}
+	if err := w.LoadScript("cycle.js", `var a = {}; a.a = a; $sendJSON(a);`); err == nil {
+		t.Fatal("expected an error when sending a cyclic value")
+	}
+	if err := w.LoadScript("undefined.js", `$sendJSON(undefined);`); err == nil {
+		t.Fatal("expected an error when sending undefined")
+	}
+}
+
+func TestJSONErrorOffset(t *testing.T) {
+	w := &Worker{}
+	if err := w.LoadScript("json.js", `$recv(function(v) {});`); err != nil {
+		t.Fatal(err)
+	}
+	// The message itself contains the text that the offset is taken from.
+	err := w.SendJSON([]byte(`{"a": " at position 1", }`))
+	jsonErr, ok := err.(*JSONError)
+	if !ok {
+		t.Fatalf("expected a *JSONError, got %#v", err)
+	}
+	if jsonErr.Offset != 24 {
+		t.Fatalf("expected the error to be at offset 24, got %d: %s", jsonErr.Offset, jsonErr)
+	}
+
+	msg := []byte(`{"a": " at position 9" x}`)
+	for _, tt := range []struct {
+		desc   string
+		offset int
+	}{
+		{"SyntaxError: Unexpected token x in JSON at position 23", 23},
+		{"SyntaxError: Unexpected end of JSON input", -1},
+		// Newer versions of V8 quote the message instead.
+		{`SyntaxError: Unexpected token 'x', "{"a": " at position 9" x}" is not valid JSON`, -1},
+		{"SyntaxError: Unexpected token x in JSON at position -1", -1},
+		{"SyntaxError: Unexpected token x in JSON at position 99", -1},
+	} {
+		if got := newJSONError(tt.desc, msg).Offset; got != tt.offset {
+			t.Errorf("%s: got offset %d want %d", tt.desc, got, tt.offset)
+		}
+	}
+}
+
+func TestChannel(t *testing.T) {
+	w := &Worker{}
+	c, err := w.OpenChannel(256)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if _, err := w.OpenChannel(256); err == nil {
+		t.Fatal("expected an error when opening a second Channel")
+	}
+	done := make(chan error, 1)
+	go func() {
+		done <- w.LoadScript("echo.js", `
+		if ($channel.inbound !== undefined || $channel.outbound !== undefined) {
+			throw new Error("expected the rings to be hidden from script");
+		}
+		for (;;) {
+			var msg = $channel.read();
+			if (msg === null) {
+				break;
+			}
+			$channel.write(msg.toUpperCase());
+		}
+`)
+	}()
+	// Send enough messages to wrap around the rings several times.
+	go func() {
+		for i := 0; i < 100; i++ {
+			if err := c.Write([]byte(fmt.Sprintf("message %d", i))); err != nil {
+				t.Error(err)
+				return
+			}
+		}
+	}()
+	for i := 0; i < 100; i++ {
+		msg, err := c.Read()
+		if err != nil {
+			t.Fatal(err)
+		}
+		if want := fmt.Sprintf("MESSAGE %d", i); string(msg) != want {
+			t.Fatalf("got %q want %q", msg, want)
+		}
+	}
+	c.Close()
+	if err := <-done; err != nil {
+		t.Fatal(err)
+	}
+	if err := c.Write([]byte("late")); err != errChannelClosed {
+		t.Fatalf("expected write to closed Channel to fail, got %v", err)
+	}
+}
+
+func TestChannelReset(t *testing.T) {
+	w := &Worker{}
+	c, err := w.OpenChannel(256)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := c.Write([]byte("before")); err != nil {
+		t.Fatal(err)
+	}
+	w.Reset()
+	if _, err := w.OpenChannel(256); err == nil {
+		t.Fatal("expected the Channel to survive the Reset")
+	}
+	if err := c.Write([]byte("after")); err != nil {
+		t.Fatal(err)
+	}
+	if err := w.LoadScript("echo.js", `
+	$channel.write($channel.read() + " " + $channel.read());
+`); err != nil {
+		t.Fatal(err)
+	}
+	msg, err := c.Read()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if want := "before after"; string(msg) != want {
+		t.Fatalf("got %q want %q", msg, want)
+	}
+	c.Close()
+}
+
+// Append a frame header claiming a message of the given length to a ring,
+// without any of the message's data.
+func corruptRing(ring unsafe.Pointer, capacity uint32, length uint32) {
+	head := atomic.LoadUint32(ringField(ring, ringHead))
+	ringCopyIn(ringData(ring, capacity), head, (*[4]byte)(unsafe.Pointer(&length))[:])
+	atomic.StoreUint32(ringField(ring, ringHead), head+4)
+}
+
+func TestChannelCorruptFrame(t *testing.T) {
+	// A frame from JavaScript that claims more data than was written.
+	w := &Worker{}
+	c, err := w.OpenChannel(256)
+	if err != nil {
+		t.Fatal(err)
+	}
+	corruptRing(c.outbound, c.capacity, 1<<31)
+	if _, err := c.Read(); err != errChannelCorrupt {
+		t.Fatalf("expected a corrupt frame to be rejected, got %v", err)
+	}
+	if err := c.Write([]byte("after")); err != errChannelClosed {
+		t.Fatalf("expected the Channel to be closed, got %v", err)
+	}
+
+	// A frame from Go that claims more than the ring's capacity.
+	var caught string
+	w = &Worker{
+		HandleSend: func(msg string) error {
+			caught = msg
+			return nil
+		},
+	}
+	c, err = w.OpenChannel(256)
+	if err != nil {
+		t.Fatal(err)
+	}
+	corruptRing(c.inbound, c.capacity, 1<<20)
+	if err := w.LoadScript("read.js", `
+	try {
+		$channel.read();
+	} catch (err) {
+		$send(err.message);
+	}
+`); err != nil {
+		t.Fatal(err)
+	}
+	if want := "v8worker: $channel is corrupt"; caught != want {
+		t.Fatalf("got %q want %q", caught, want)
+	}
+	if err := c.Write([]byte("after")); err != errChannelClosed {
+		t.Fatalf("expected the Channel to be poisoned, got %v", err)
+	}
+}
+
+func BenchmarkChannelThroughput(b *testing.B) {
+	w := &Worker{}
+	c, err := w.OpenChannel(1 << 20)
+	if err != nil {
+		b.Fatal(err)
+	}
+	done := make(chan error, 1)
+	go func() {
+		done <- w.LoadScript("drain.js", `while ($channel.read() !== null) {}`)
+	}()
+	msg := bytes.Repeat([]byte("x"), 200)
+	b.SetBytes(int64(len(msg)))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := c.Write(msg); err != nil {
+			b.Fatal(err)
+		}
+	}
+	c.Close()
+	if err := <-done; err != nil {
+		b.Fatal(err)
+	}
+}
+
+func BenchmarkSendThroughput(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `$recv(function(msg) {});`); err != nil {
+		b.Fatal(err)
+	}
+	msg := strings.Repeat("x", 200)
+	b.SetBytes(int64(len(msg)))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := w.Send(msg); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestSendAsync(t *testing.T) {
+	release := map[string]chan struct{}{
+		"a": make(chan struct{}),
+		"b": make(chan struct{}),
+		"c": make(chan struct{}),
+	}
+	settled := make(chan string, 3)
+	w := &Worker{
+		HandleSend: func(msg string) error {
+			settled <- msg
+			return nil
+		},
+		HandleSendAsync: func(msg string) (string, error) {
+			<-release[msg]
+			if msg == "c" {
+				return "", fmt.Errorf("failed %s", msg)
+			}
+			return strings.ToUpper(msg), nil
+		},
+	}
+	if err := w.LoadScript("async.js", `
+	["a", "b", "c"].forEach(function(msg) {
+		$sendAsync(msg).then(function(resp) {
+			$send(msg + ":" + resp);
+		}, function(err) {
+			$send(msg + ":" + err.message);
+		});
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	for _, msg := range []string{"c", "b", "a"} {
+		close(release[msg])
+		want := map[string]string{"a": "a:A", "b": "b:B", "c": "c:failed c"}[msg]
+		select {
+		case got := <-settled:
+			if got != want {
+				t.Fatalf("bad result: got %q, want %q", got, want)
+			}
+		case <-time.After(5 * time.Second):
+			t.Fatalf("timed out waiting for request %q to settle", msg)
+		}
+	}
+}
+
+func BenchmarkSendAsync(b *testing.B) {
+	done := make(chan struct{}, 1)
+	w := &Worker{
+		HandleSend: func(msg string) error {
+			done <- struct{}{}
+			return nil
+		},
+		HandleSendAsync: func(msg string) (string, error) {
+			return msg, nil
+		},
+	}
+	if err := w.LoadScript("async.js", `
+	$recv(function(msg) {
+		$sendAsync(msg).then(function(resp) { $send(resp); });
+	});
+`); err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		if err := w.Send("ping"); err != nil {
+			b.Fatal(err)
+		}
+		<-done
+	}
+}
+
+func TestSendAsyncAwaitsPromises(t *testing.T) {
+	release := map[string]chan struct{}{
+		"a": make(chan struct{}),
+		"b": make(chan struct{}),
+	}
+	w := &Worker{
+		HandleSendAsync: func(msg string) (string, error) {
+			<-release[msg]
+			return strings.ToUpper(msg), nil
+		},
+	}
+	if err := w.LoadScript("recv.js", `
+	$recvSync(function(msg) {
+		if (msg === "plain") {
+			return "plain";
+		}
+		if (msg === "fail") {
+			return Promise.reject(new Error("failed"));
+		}
+		return $sendAsync(msg).then(function(resp) {
+			return msg + "=" + resp;
+		});
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+	wait := func(result <-chan Result) Result {
+		select {
+		case r := <-result:
+			return r
+		case <-time.After(5 * time.Second):
+			t.Fatal("timed out waiting for result")
+		}
+		return Result{}
+	}
+	a := w.SendAsync("a")
+	b := w.SendAsync("b")
+	if r := wait(w.SendAsync("plain")); r.Response != "plain" || r.Err != nil {
+		t.Fatalf("bad result for sync response: %#v", r)
+	}
+	if r := wait(w.SendAsync("fail")); r.Err == nil || !strings.Contains(r.Err.Error(), "failed") {
+		t.Fatalf("expected rejection, got %#v", r)
+	}
+	close(release["b"])
+	if r := wait(b); r.Response != "b=B" || r.Err != nil {
+		t.Fatalf("bad result for b: %#v", r)
+	}
+	close(release["a"])
+	if r := wait(a); r.Response != "a=A" || r.Err != nil {
+		t.Fatalf("bad result for a: %#v", r)
+	}
+}
+
+func BenchmarkSendAsyncResolved(b *testing.B) {
+	w := &Worker{}
+	if err := w.LoadScript("recv.js", `
+	$recvSync(async function(msg) { return msg; });
+`); err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		if r := <-w.SendAsync("ping"); r.Err != nil {
+			b.Fatal(r.Err)
+		}
+	}
+}
+
+func TestOwnedWorker(t *testing.T) {
+	var w *Worker
+	w = &Worker{
+		HandleSend: func(msg string) error {
+			return nil
+		},
+		HandleSendSync: func(msg string) (string, error) {
+			// Calls made from the owner thread itself run directly.
+			if err := w.Send("nested"); err != nil {
+				return "", err
+			}
+			return msg, nil
+		},
+		HandleSendAsync: func(msg string) (string, error) {
+			return msg, nil
+		},
+		Owned: true,
+	}
+	if err := w.LoadScript("owned.js", `
+	var count = 0;
+	$recv(function(msg) { count++; });
+	$recvSync(function(msg) {
+		if (msg === "count") {
+			return String(count);
+		}
+		return $sendSync(msg);
+	});
+`); err != nil {
+		t.Fatal(err)
+	}
+
+	var wg sync.WaitGroup
+	errs := make(chan error, 40)
+	for i := 0; i < 4; i++ {
+		wg.Add(3)
+		go func(i int) {
+			defer wg.Done()
+			for j := 0; j < 10; j++ {
+				if err := w.Send("inc"); err != nil {
+					errs <- err
+				}
+			}
+		}(i)
+		go func(i int) {
+			defer wg.Done()
+			src := fmt.Sprintf(`$sendAsync("%d").then(function(v) { $send(v); });`, i)
+			if err := w.LoadScript(fmt.Sprintf("load%d.js", i), src); err != nil {
+				errs <- err
+			}
+		}(i)
+		go func(i int) {
+			defer wg.Done()
+			msg := fmt.Sprintf("echo%d", i)
+			if resp, err := w.SendSync(msg); err != nil || resp != msg {
+				errs <- fmt.Errorf("bad response to %q: %q, %v", msg, resp, err)
+			}
+		}(i)
+	}
+	wg.Wait()
+	close(errs)
+	for err := range errs {
+		t.Fatal(err)
+	}
+	// Each SendSync also makes a nested Send.
+	if resp, _ := w.SendSync("count"); resp != "44" {
+		t.Fatalf("expected 44 messages to have been received, got %s", resp)
+	}
+	w.LowMemoryNotification()
+
+	done := make(chan struct{})
+	go func() {
+		time.Sleep(100 * time.Millisecond)
+		w.Terminate()
+		close(done)
+	}()
+	w.LoadScript("forever.js", `while (true) {}`)
+	<-done
+}
+
+func benchmarkSendParallel(b *testing.B, owned bool) {
+	w := &Worker{Owned: owned}
+	if err := w.LoadScript("recv.js", `$recv(function(msg) {});`); err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		for pb.Next() {
+			if err := w.Send("ping"); err != nil {
+				b.Fatal(err)
+			}
+		}
+	})
+}
+
+func BenchmarkSendParallelLocker(b *testing.B) { benchmarkSendParallel(b, false) }
+func BenchmarkSendParallelOwned(b *testing.B)  { benchmarkSendParallel(b, true) }
+
+func benchmarkSendSerial(b *testing.B, owned bool) {
+	w := &Worker{Owned: owned}
+	if err := w.LoadScript("recv.js", `$recv(function(msg) {});`); err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		if err := w.Send("ping"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkSendSerialLocker(b *testing.B) { benchmarkSendSerial(b, false) }
+func BenchmarkSendSerialOwned(b *testing.B)  { benchmarkSendSerial(b, true) }
+
+func TestArrayBufferAccounting(t *testing.T) {
+	w := &Worker{
+		HandleSendBuffer: func(buf *Buffer) {
+			buf.Free()
+		},
+		MaxArrayBufferBytes: 1 << 20,
+	}
+	if err := w.LoadScript("alloc.js", `
+	var kept = new Uint8Array(4096);
+	$recv(function(buf) { kept = buf; });
+`); err != nil {
+		t.Fatal(err)
+	}
+	before := w.ArrayBufferBytes()
+	if before < 4096 {
+		t.Fatalf("expected at least 4096 bytes to be accounted for, got %d", before)
+	}
+	if err := w.LoadScript("limit.js", `new ArrayBuffer(2 << 20);`); err == nil {
+		t.Fatal("expected an error when exceeding MaxArrayBufferBytes")
+	}
+	if err := w.LoadScript("send.js", `$sendBuffer(kept);`); err != nil {
+		t.Fatal(err)
+	}
+	if after := w.ArrayBufferBytes(); after != before-4096 {
+		t.Fatalf("expected %d bytes after sending a buffer to Go, got %d", before-4096, after)
+	}
+	if err := w.SendBuffer(NewBuffer(1000)); err != nil {
+		t.Fatal(err)
+	}
+	if after := w.ArrayBufferBytes(); after != before-4096+1000 {
+		t.Fatalf("expected %d bytes after sending a buffer from Go, got %d", before-4096+1000, after)
+	}
+}
+
+func BenchmarkTypedArrayAlloc(b *testing.B) {
+	w := newWorker(nil, nil)
+	if err := w.LoadScript("recv.js", `
+	$recv(function(msg) {
+		for (var i = 0; i < 100; i++) {
+			new Float64Array(32)[0] = i;
+		}
+	});
+`); err != nil {
+		b.Fatal(err)
+	}
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		if err := w.Send("alloc"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func TestHeapLimit(t *testing.T) {
+	w := &Worker{MaxHeapBytes: 32 << 20}
+	err := w.LoadScript("grow.js", `
+	var hoard = [];
+	while (true) {
+		hoard.push(new Array(1000).fill("x"));
+	}
+`)
+	if err == nil || !strings.Contains(err.Error(), "heap limit") {
+		t.Fatalf("expected a heap limit error, got %v", err)
+	}
+	if !w.HeapLimitReached() {
+		t.Fatal("expected the Worker to have failed")
+	}
+	if err := w.LoadScript("after.js", `1 + 1;`); err == nil {
+		t.Fatal("expected calls into a failed Worker to return an error")
+	}
+	w.Reset()
+	if w.HeapLimitReached() {
+		t.Fatal("expected Reset to recover the Worker")
+	}
+	if err := w.LoadScript("reset.js", `1 + 1;`); err != nil {
+		t.Fatal(err)
+	}
+	err = w.LoadScript("regrow.js", `
+	var hoard = [];
+	while (true) {
+		hoard.push(new Array(1000).fill("x"));
+	}
+`)
+	if err == nil || !strings.Contains(err.Error(), "heap limit") {
+		t.Fatalf("expected the heap limit to be restored by Reset, got %v", err)
+	}
+
+	other := &Worker{}
+	if err := other.LoadScript("other.js", `1 + 1;`); err != nil {
+		t.Fatal(err)
+	}
+	if other.HeapLimitReached() {
+		t.Fatal("expected other Workers to be unaffected")
+	}
+}